@@ -5,4 +5,12 @@
 #define DRM_CLIENT_CAP_UNIVERSAL_PLANES 2
 #endif
 
+#ifndef DRM_CLIENT_CAP_ATOMIC
+#define DRM_CLIENT_CAP_ATOMIC 3
+#endif
+
+#ifndef DRM_MODE_ATOMIC_NONBLOCK
+#define DRM_MODE_ATOMIC_NONBLOCK 0x0200
+#endif
+
 #endif
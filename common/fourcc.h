@@ -26,6 +26,22 @@
 		16, XvPlanar, 3,  0, 0, 0, 0, \
 		8, 8, 8,  1, 2, 2,  1, 1, 1,  "YVU", XvTopToBottom, }
 
+#ifndef FOURCC_NV12
+#define FOURCC_NV12 0x3231564e
+#endif
+#ifndef XVIMAGE_NV12
+#define XVIMAGE_NV12 { \
+		FOURCC_NV12, XvYUV, LSBFirst, GUID4CC('N', 'V', '1', '2'), \
+		12, XvPlanar, 2,  0, 0, 0, 0, \
+		8, 8, 8,  1, 2, 2,  1, 2, 2,  "YUV", XvTopToBottom, }
+#endif
+
+#define FOURCC_NV16 0x3631564e
+#define XVIMAGE_NV16 { \
+		FOURCC_NV16, XvYUV, LSBFirst, GUID4CC('N', 'V', '1', '6'), \
+		16, XvPlanar, 2,  0, 0, 0, 0, \
+		8, 8, 8,  1, 2, 2,  1, 1, 1,  "YUV", XvTopToBottom, }
+
 #define XVIMAGE_ARGB8888 { \
 		DRM_FORMAT_ARGB8888, XvRGB, LSBFirst, { 0 }, \
 		32, XvPacked, 1,  24, 0xff0000, 0x00ff00, 0x0000ff, \
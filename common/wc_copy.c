@@ -0,0 +1,96 @@
+/*
+ * Copying into write-combining buffers
+ *
+ * Write-combined mappings are not cached, so each store goes straight
+ * to the CPU write buffer.  The write buffer can only merge stores
+ * into a full bus burst if they fill a whole cache line in order, so
+ * align the destination and copy in cache line sized blocks, loading
+ * a block before storing any of it.
+ */
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdint.h>
+#include <string.h>
+
+#include "prefetch.h"
+#include "wc_copy.h"
+
+#define WC_LINE		32
+
+#if defined(__arm__) && defined(__ARM_NEON__)
+#define WC_BLOCK	64
+
+/* Copy a multiple of WC_BLOCK bytes to a WC_LINE aligned destination */
+static void wc_copy_blocks(void *dst, const void *src, size_t n)
+{
+	asm volatile(
+	"1:	pld	[%1, #192]\n"
+	"	vld1.8	{d0-d3}, [%1]!\n"
+	"	vld1.8	{d4-d7}, [%1]!\n"
+	"	subs	%2, %2, #64\n"
+	"	vst1.8	{d0-d3}, [%0, :128]!\n"
+	"	vst1.8	{d4-d7}, [%0, :128]!\n"
+	"	bgt	1b\n"
+		: "+r" (dst), "+r" (src), "+r" (n)
+		:
+		: "d0", "d1", "d2", "d3", "d4", "d5", "d6", "d7",
+		  "cc", "memory");
+}
+#else
+#define WC_BLOCK	WC_LINE
+
+/*
+ * Portable version, which on ARM is compiled to ldm/stm pairs.  The
+ * source must be 32-bit aligned.
+ */
+static void wc_copy_blocks(void *dst, const void *src, size_t n)
+{
+	const uint32_t *s = src;
+	uint32_t *d = dst;
+
+	for (; n; n -= WC_BLOCK, s += 8, d += 8) {
+		uint32_t w0 = s[0], w1 = s[1], w2 = s[2], w3 = s[3];
+		uint32_t w4 = s[4], w5 = s[5], w6 = s[6], w7 = s[7];
+
+		prefetch(s + 24);
+		d[0] = w0; d[1] = w1; d[2] = w2; d[3] = w3;
+		d[4] = w4; d[5] = w5; d[6] = w6; d[7] = w7;
+	}
+}
+#endif
+
+void wc_copy(void *dst, const void *src, size_t n)
+{
+	size_t head, bulk;
+
+#if WC_BLOCK == WC_LINE
+	if (((uintptr_t)dst ^ (uintptr_t)src) & 3) {
+		memcpy(dst, src, n);
+		return;
+	}
+#endif
+
+	/* Bring the destination up to a cache line boundary */
+	head = -(uintptr_t)dst & (WC_LINE - 1);
+	if (head > n)
+		head = n;
+	if (head) {
+		memcpy(dst, src, head);
+		dst = (char *)dst + head;
+		src = (const char *)src + head;
+		n -= head;
+	}
+
+	bulk = n & ~(size_t)(WC_BLOCK - 1);
+	if (bulk) {
+		wc_copy_blocks(dst, src, bulk);
+		dst = (char *)dst + bulk;
+		src = (const char *)src + bulk;
+		n -= bulk;
+	}
+
+	if (n)
+		memcpy(dst, src, n);
+}
@@ -0,0 +1,17 @@
+#ifndef WC_COPY_H
+#define WC_COPY_H
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stddef.h>
+
+/*
+ * Copy into a write-combining (uncached, bufferable) destination.
+ * The destination is written in whole cache-line sized bursts so
+ * that the CPU write buffer can merge them into full bus transfers.
+ */
+void wc_copy(void *dst, const void *src, size_t n);
+
+#endif
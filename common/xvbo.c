@@ -0,0 +1,41 @@
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "dix.h"
+#include "resource.h"
+
+#include "xvbo.h"
+
+/*
+ * Look up the pixmap named by an XVPX image.  This must be done on
+ * behalf of the client making the request, so that it can only
+ * display pixmaps it could otherwise read, and XACE gets its say.
+ * Servers which can not tell us the client do not support XVPX.
+ */
+int xvpx_lookup_pixmap(PixmapPtr *ppix, XID xid)
+{
+#if HAVE_DECL_GETCURRENTCLIENT
+	ClientPtr client = GetCurrentClient();
+
+	if (client)
+		return dixLookupResourceByType((pointer *)ppix, xid,
+					       RT_PIXMAP, client,
+					       DixReadAccess);
+#endif
+	return BadAccess;
+}
+
+/*
+ * The planes of an XVPX image are read using the pitches and offsets
+ * which QueryImageAttributes returned for the image, so the pixmap
+ * must have the same pitch, with pixels the size of the first plane's.
+ */
+Bool xvpx_pixmap_layout_ok(PixmapPtr pixmap, const XF86ImageRec *image,
+	int pitch)
+{
+	int bpp = image->format == XvPacked ? image->bits_per_pixel : 8;
+
+	return pixmap->drawable.bitsPerPixel == bpp &&
+	       pixmap->devKind == pitch;
+}
@@ -1,6 +1,9 @@
 #ifndef XVBO_H
 #define XVBO_H
 
+#include "pixmapstr.h"
+#include "xf86xv.h"
+
 /*
  * This is a special Xv image format used to pass DRM named buffers
  * via the Xv protocol to the backend, allowing for zero copy display.
@@ -30,4 +33,39 @@
 	XvTopToBottom, \
 }
 
+/*
+ * A variant of XVBO for DMA-BUF buffers.  Flink names are not available
+ * on render nodes, and file descriptors can not be passed via the Xv
+ * protocol, so the application first imports the DMA-BUF as a pixmap
+ * via DRI3 PixmapFromBuffer, and then passes the pixmap XID instead:
+ *  word 0: fourcc of the data contained in the buffer
+ *  word 1: XID of the pixmap
+ *
+ * The buffer is imported once when the pixmap is created; displaying a
+ * frame only requires the pixmap to be looked up, which is subject to
+ * the requesting client's access rights.  The pixmap's stride must be
+ * the image's first pitch, and its bits per pixel those of the first
+ * plane.
+ */
+#define FOURCC_XVPX 0x58505658
+#define XVIMAGE_XVPX { \
+	FOURCC_XVPX, \
+	XvYUV, \
+	LSBFirst, \
+	{ 0 }, \
+	0, \
+	XvPlanar, \
+	1, \
+	0, 0, 0, 0, \
+	8, 8, 8, \
+	1, 2, 2, \
+	1, 1, 1, \
+	"I", \
+	XvTopToBottom, \
+}
+
+int xvpx_lookup_pixmap(PixmapPtr *ppix, XID xid);
+Bool xvpx_pixmap_layout_ok(PixmapPtr pixmap, const XF86ImageRec *image,
+	int pitch);
+
 #endif
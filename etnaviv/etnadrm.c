@@ -28,6 +28,7 @@ struct etna_viv_conn {
 	struct bo_cache cache;
 	unsigned int etnadrm_pipe;
 	unsigned int api_date;
+	unsigned int flush_seq;
 };
 
 static struct etna_viv_conn *to_etna_viv_conn(struct viv_conn *conn)
@@ -924,6 +925,8 @@ int etna_flush(struct etna_ctx *ctx, uint32_t *fence_out)
 		return ETNA_INTERNAL_ERROR;
 	}
 
+	to_etna_viv_conn(ctx->conn)->flush_seq++;
+
 	buf = ctx->cmdbuf[ctx->cur_buf];
 	xorg_list_for_each_entry_safe(i, n, &buf->bo_head, node) {
 		xorg_list_del(&i->node);
@@ -964,6 +967,16 @@ int etna_finish(struct etna_ctx *ctx)
 	return ETNA_OK;
 }
 
+/*
+ * The number of command buffer submissions so far, including those made
+ * when etna_reserve() runs out of space.  The GPU state is not preserved
+ * from one submission to the next.
+ */
+unsigned int etnadrm_flush_seq(struct viv_conn *conn)
+{
+	return to_etna_viv_conn(conn)->flush_seq;
+}
+
 int _etna_reserve_internal(struct etna_ctx *ctx, size_t n)
 {
 	uint32_t next_fence;
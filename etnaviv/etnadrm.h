@@ -8,5 +8,6 @@ struct viv_conn;
 void etna_emit_reloc(struct etna_ctx *ctx, uint32_t buf_offset,
 	struct etna_bo *mem, uint32_t offset, Bool write);
 int etnadrm_open_render(const char *name);
+unsigned int etnadrm_flush_seq(struct viv_conn *conn);
 
 #endif
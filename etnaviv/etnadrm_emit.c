@@ -26,3 +26,8 @@ void etnaviv_emit(struct etnaviv *etnaviv)
 	}
 	ctx->offset += etnaviv->batch_size;
 }
+
+unsigned int etnaviv_flush_seq(struct etnaviv *etnaviv)
+{
+	return etnadrm_flush_seq(etnaviv->conn);
+}
@@ -48,6 +48,7 @@
 
 etnaviv_Key etnaviv_pixmap_index;
 etnaviv_Key etnaviv_screen_index;
+etnaviv_Key etnaviv_gc_index;
 int etnaviv_private_index = -1;
 
 enum {
@@ -186,15 +187,15 @@ static void etnaviv_free_pixmap(PixmapPtr pixmap)
 /* Determine whether this GC and target Drawable can be accelerated */
 static Bool etnaviv_GC_can_accel(GCPtr pGC, DrawablePtr pDrawable)
 {
-	if (!etnaviv_drawable(pDrawable))
-		return FALSE;
-
-	/* Must be full-planes */
-	return !pGC || fb_full_planemask(pDrawable, pGC->planemask);
+	return etnaviv_drawable(pDrawable);
 }
 
 static Bool etnaviv_GCfill_can_accel(GCPtr pGC, DrawablePtr pDrawable)
 {
+	/* Partial planemasks are only handled for solid fills */
+	if (!fb_full_planemask(pDrawable, pGC->planemask))
+		return pGC->fillStyle == FillSolid;
+
 	switch (pGC->fillStyle) {
 	case FillSolid:
 		return TRUE;
@@ -209,14 +210,21 @@ static Bool etnaviv_GCfill_can_accel(GCPtr pGC, DrawablePtr pDrawable)
 		    pGC->tile.pixmap->drawable.height == 1)
 			return TRUE;
 
-		/* In theory, we could do !tileIsPixel as well, which means
-		 * copying the tile (possibly) multiple times to the drawable.
-		 * This is something we should do, especially if the size of
-		 * the tile matches the size of the drawable and the tile
-		 * offsets are zero (iow, it's a plain copy.)
+		/* 8x8 tiles can be loaded as a pattern brush */
+		if (etnaviv_GC_tile_is_pattern(pGC))
+			return TRUE;
+
+		/*
+		 * Other tiles are copied multiple times to the drawable,
+		 * which etnaviv_accel_PolyFillRectTiled() handles.
 		 */
 		return FALSE;
 
+	case FillStippled:
+	case FillOpaqueStippled:
+		/* Stipples which reduce to 8x8 are loaded as a mono pattern */
+		return etnaviv_get_gc_priv(pGC)->stipple_valid;
+
 	default:
 		return FALSE;
 	}
@@ -282,33 +290,163 @@ etnaviv_PolyPoint(DrawablePtr pDrawable, GCPtr pGC, int mode, int npt,
 		unaccel_PolyPoint(pDrawable, pGC, mode, npt, ppt);
 }
 
+/*
+ * Polygons, arcs and wide lines are rasterised by mi into spans and
+ * points; batch them so that the whole shape is drawn by a single GPU
+ * operation.
+ */
+static Bool
+etnaviv_shape_begin(DrawablePtr pDrawable, GCPtr pGC)
+{
+	struct etnaviv *etnaviv = etnaviv_get_screen_priv(pDrawable->pScreen);
+
+	assert(etnaviv_GC_can_accel(pGC, pDrawable));
+
+	return !etnaviv->force_fallback &&
+	       etnaviv_GCfill_can_accel(pGC, pDrawable) &&
+	       etnaviv_accel_shape_begin(pDrawable, pGC);
+}
+
 static void
 etnaviv_PolyLines(DrawablePtr pDrawable, GCPtr pGC, int mode, int npt,
 	DDXPointPtr ppt)
 {
 	struct etnaviv *etnaviv = etnaviv_get_screen_priv(pDrawable->pScreen);
+	Bool batch;
 
 	assert(etnaviv_GC_can_accel(pGC, pDrawable));
 
-	if (etnaviv->force_fallback ||
-	    pGC->lineWidth != 0 || pGC->lineStyle != LineSolid ||
-	    pGC->fillStyle != FillSolid ||
-	    !etnaviv_accel_PolyLines(pDrawable, pGC, mode, npt, ppt))
+	if (pGC->lineWidth == 0) {
+		if (etnaviv->force_fallback || pGC->fillStyle != FillSolid)
+			goto fallback;
+
+		if (pGC->lineStyle == LineSolid) {
+			if (etnaviv_accel_PolyLines(pDrawable, pGC, mode, npt,
+						    ppt))
+				return;
+		} else {
+			if (etnaviv_accel_PolyLinesDash(pDrawable, pGC, mode,
+							npt, ppt))
+				return;
+		}
+ fallback:
 		unaccel_PolyLines(pDrawable, pGC, mode, npt, ppt);
+		return;
+	}
+
+	/* A single wide line has no joins, so may be a rectangle */
+	if (!etnaviv->force_fallback && npt == 2 &&
+	    pGC->lineStyle == LineSolid) {
+		xSegment seg;
+
+		seg.x1 = ppt[0].x;
+		seg.y1 = ppt[0].y;
+		seg.x2 = ppt[1].x;
+		seg.y2 = ppt[1].y;
+		if (mode == CoordModePrevious) {
+			seg.x2 += seg.x1;
+			seg.y2 += seg.y1;
+		}
+
+		if (etnaviv_accel_PolySegmentWide(pDrawable, pGC, 1, &seg))
+			return;
+	}
+
+	/* Double dashed lines change the GC colour between dashes */
+	batch = pGC->lineStyle != LineDoubleDash &&
+		etnaviv_shape_begin(pDrawable, pGC);
+
+	if (pGC->lineStyle == LineSolid)
+		miWideLine(pDrawable, pGC, mode, npt, ppt);
+	else
+		miWideDash(pDrawable, pGC, mode, npt, ppt);
+
+	if (batch)
+		etnaviv_accel_shape_end(pDrawable);
 }
 
 static void
 etnaviv_PolySegment(DrawablePtr pDrawable, GCPtr pGC, int nseg, xSegment *pSeg)
 {
 	struct etnaviv *etnaviv = etnaviv_get_screen_priv(pDrawable->pScreen);
+	Bool batch;
 
 	assert(etnaviv_GC_can_accel(pGC, pDrawable));
 
-	if (etnaviv->force_fallback ||
-	    pGC->lineWidth != 0 || pGC->lineStyle != LineSolid ||
-	    pGC->fillStyle != FillSolid ||
-	    !etnaviv_accel_PolySegment(pDrawable, pGC, nseg, pSeg))
+	if (pGC->lineWidth == 0) {
+		if (etnaviv->force_fallback || pGC->fillStyle != FillSolid)
+			goto fallback;
+
+		if (pGC->lineStyle == LineSolid) {
+			if (etnaviv_accel_PolySegment(pDrawable, pGC, nseg,
+						      pSeg))
+				return;
+		} else {
+			if (etnaviv_accel_PolySegmentDash(pDrawable, pGC, nseg,
+							  pSeg))
+				return;
+		}
+ fallback:
 		unaccel_PolySegment(pDrawable, pGC, nseg, pSeg);
+		return;
+	}
+
+	if (!etnaviv->force_fallback && pGC->lineStyle == LineSolid &&
+	    etnaviv_accel_PolySegmentWide(pDrawable, pGC, nseg, pSeg))
+		return;
+
+	/* mi draws each segment through our PolyLines */
+	batch = pGC->lineStyle != LineDoubleDash &&
+		etnaviv_shape_begin(pDrawable, pGC);
+
+	miPolySegment(pDrawable, pGC, nseg, pSeg);
+
+	if (batch)
+		etnaviv_accel_shape_end(pDrawable);
+}
+
+static void
+etnaviv_PolyArc(DrawablePtr pDrawable, GCPtr pGC, int narcs, xArc *parcs)
+{
+	Bool batch;
+
+	/*
+	 * Dashed arcs change the GC colours, and arcs with non-idempotent
+	 * ALUs are drawn via a scratch bitmap and PushPixels, neither of
+	 * which can be batched.
+	 */
+	batch = pGC->lineStyle == LineSolid && pGC->fillStyle == FillSolid &&
+		(pGC->alu == GXcopy || pGC->alu == GXclear ||
+		 pGC->alu == GXset || pGC->alu == GXcopyInverted) &&
+		etnaviv_shape_begin(pDrawable, pGC);
+
+	miPolyArc(pDrawable, pGC, narcs, parcs);
+
+	if (batch)
+		etnaviv_accel_shape_end(pDrawable);
+}
+
+static void
+etnaviv_FillPolygon(DrawablePtr pDrawable, GCPtr pGC, int shape, int mode,
+	int count, DDXPointPtr pPts)
+{
+	Bool batch = etnaviv_shape_begin(pDrawable, pGC);
+
+	miFillPolygon(pDrawable, pGC, shape, mode, count, pPts);
+
+	if (batch)
+		etnaviv_accel_shape_end(pDrawable);
+}
+
+static void
+etnaviv_PolyFillArc(DrawablePtr pDrawable, GCPtr pGC, int narcs, xArc *parcs)
+{
+	Bool batch = etnaviv_shape_begin(pDrawable, pGC);
+
+	miPolyFillArc(pDrawable, pGC, narcs, parcs);
+
+	if (batch)
+		etnaviv_accel_shape_end(pDrawable);
 }
 
 static void
@@ -327,7 +465,8 @@ etnaviv_PolyFillRect(DrawablePtr pDrawable, GCPtr pGC, int nrect,
 	if (etnaviv_GCfill_can_accel(pGC, pDrawable)) {
 		if (etnaviv_accel_PolyFillRectSolid(pDrawable, pGC, nrect, prect))
 			return;
-	} else if (pGC->fillStyle == FillTiled) {
+	} else if (pGC->fillStyle == FillTiled &&
+		   fb_full_planemask(pDrawable, pGC->planemask)) {
 		if (etnaviv_accel_PolyFillRectTiled(pDrawable, pGC, nrect, prect))
 			return;
 	}
@@ -336,6 +475,88 @@ etnaviv_PolyFillRect(DrawablePtr pDrawable, GCPtr pGC, int nrect,
 	unaccel_PolyFillRect(pDrawable, pGC, nrect, prect);
 }
 
+static void
+etnaviv_ImageGlyphBlt(DrawablePtr pDrawable, GCPtr pGC, int x, int y,
+	unsigned int nglyph, CharInfoPtr *ppci, pointer pglyphBase)
+{
+	struct etnaviv *etnaviv = etnaviv_get_screen_priv(pDrawable->pScreen);
+
+	assert(etnaviv_GC_can_accel(pGC, pDrawable));
+
+	if (etnaviv->force_fallback ||
+	    !fb_full_planemask(pDrawable, pGC->planemask) ||
+	    !etnaviv_accel_ImageGlyphBlt(pDrawable, pGC, x, y, nglyph, ppci,
+					 pglyphBase))
+		unaccel_ImageGlyphBlt(pDrawable, pGC, x, y, nglyph, ppci,
+				      pglyphBase);
+}
+
+static void
+etnaviv_PolyGlyphBlt(DrawablePtr pDrawable, GCPtr pGC, int x, int y,
+	unsigned int nglyph, CharInfoPtr *ppci, pointer pglyphBase)
+{
+	struct etnaviv *etnaviv = etnaviv_get_screen_priv(pDrawable->pScreen);
+
+	assert(etnaviv_GC_can_accel(pGC, pDrawable));
+
+	if (etnaviv->force_fallback || pGC->fillStyle != FillSolid ||
+	    !fb_full_planemask(pDrawable, pGC->planemask) ||
+	    !etnaviv_accel_PolyGlyphBlt(pDrawable, pGC, x, y, nglyph, ppci,
+					pglyphBase))
+		unaccel_PolyGlyphBlt(pDrawable, pGC, x, y, nglyph, ppci,
+				     pglyphBase);
+}
+
+static Bool etnaviv_stipple_bit(PixmapPtr pStipple, int x, int y)
+{
+	const uint8_t *row = (uint8_t *)pStipple->devPrivate.ptr +
+			     y * pStipple->devKind;
+
+#if BITMAP_BIT_ORDER == LSBFirst
+	return row[x >> 3] >> (x & 7) & 1;
+#else
+	return row[x >> 3] >> (7 - (x & 7)) & 1;
+#endif
+}
+
+/*
+ * Reduce the GC stipple to an 8x8 pattern for the brush.  This is only
+ * possible if the stipple repeats every 8 pixels in both directions.
+ * The stipple must be prepared for CPU access.
+ */
+static void etnaviv_validate_stipple(GCPtr pGC)
+{
+	struct etnaviv_gc_priv *priv = etnaviv_get_gc_priv(pGC);
+	PixmapPtr pStipple = pGC->stipple;
+	int w = pStipple->drawable.width;
+	int h = pStipple->drawable.height;
+	int x, y;
+
+	priv->stipple_valid = FALSE;
+
+	if ((8 % w && w % 8) || (8 % h && h % 8) || w > 64 || h > 64)
+		return;
+
+	for (y = 0; y < 8; y++) {
+		uint8_t row = 0;
+
+		for (x = 0; x < 8; x++)
+			if (etnaviv_stipple_bit(pStipple, x % w, y % h))
+				row |= 0x80 >> x;
+
+		priv->stipple[y] = row;
+	}
+
+	/* Larger stipples must repeat every 8 pixels */
+	for (y = 0; y < h; y++)
+		for (x = 0; x < w; x++)
+			if (etnaviv_stipple_bit(pStipple, x, y) !=
+			    (priv->stipple[y & 7] >> (7 - (x & 7)) & 1))
+				return;
+
+	priv->stipple_valid = TRUE;
+}
+
 static GCOps etnaviv_GCOps = {
 	etnaviv_FillSpans,
 	unaccel_SetSpans,
@@ -346,16 +567,16 @@ static GCOps etnaviv_GCOps = {
 	etnaviv_PolyLines,
 	etnaviv_PolySegment,
 	miPolyRectangle,
-	miPolyArc,
-	miFillPolygon,
+	etnaviv_PolyArc,
+	etnaviv_FillPolygon,
 	etnaviv_PolyFillRect,
-	miPolyFillArc,
+	etnaviv_PolyFillArc,
 	miPolyText8,
 	miPolyText16,
 	miImageText8,
 	miImageText16,
-	unaccel_ImageGlyphBlt,
-	unaccel_PolyGlyphBlt,
+	etnaviv_ImageGlyphBlt,
+	etnaviv_PolyGlyphBlt,
 	unaccel_PushPixels
 };
 
@@ -401,6 +622,7 @@ etnaviv_ValidateGC(GCPtr pGC, unsigned long changes, DrawablePtr pDrawable)
 	if (changes & GCStipple && pGC->stipple) {
 		prepare_cpu_drawable(&pGC->stipple->drawable, CPU_ACCESS_RW);
 		fbValidateGC(pGC, changes, pDrawable);
+		etnaviv_validate_stipple(pGC);
 		finish_cpu_drawable(&pGC->stipple->drawable, CPU_ACCESS_RW);
 	} else {
 		fbValidateGC(pGC, changes, pDrawable);
@@ -436,6 +658,7 @@ static Bool etnaviv_CloseScreen(CLOSE_SCREEN_ARGS_DECL)
 	DeleteCallback(&FlushCallback, etnaviv_flush_callback, pScrn);
 
 	etnaviv_render_close_screen(pScreen);
+	etnaviv_free_scratch(pScreen);
 
 	pScreen->CloseScreen = etnaviv->CloseScreen;
 	pScreen->GetImage = etnaviv->GetImage;
@@ -445,6 +668,7 @@ static Bool etnaviv_CloseScreen(CLOSE_SCREEN_ARGS_DECL)
 	pScreen->CreatePixmap = etnaviv->CreatePixmap;
 	pScreen->DestroyPixmap = etnaviv->DestroyPixmap;
 	pScreen->CreateGC = etnaviv->CreateGC;
+	pScreen->UnrealizeFont = etnaviv->UnrealizeFont;
 	pScreen->BitmapToRegion = etnaviv->BitmapToRegion;
 	pScreen->BlockHandler = etnaviv->BlockHandler;
 
@@ -757,6 +981,16 @@ static Bool etnaviv_CreateGC(GCPtr pGC)
 	return ret;
 }
 
+static Bool etnaviv_UnrealizeFont(ScreenPtr pScreen, FontPtr pFont)
+{
+	struct etnaviv *etnaviv = etnaviv_get_screen_priv(pScreen);
+
+	/* Drop any cached glyphs for this font */
+	etnaviv_accel_UnrealizeFont(etnaviv, pFont);
+
+	return etnaviv->UnrealizeFont(pScreen, pFont);
+}
+
 /* Commit any pending GPU operations */
 static void etnaviv_BlockHandler(BLOCKHANDLER_ARGS_DECL)
 {
@@ -841,7 +1075,9 @@ static Bool etnaviv_ScreenInit(ScreenPtr pScreen, struct drm_armada_bufmgr *mgr)
 	struct etnaviv *etnaviv = pScrn->privates[etnaviv_private_index].ptr;
 
 	if (!etnaviv_CreateKey(&etnaviv_pixmap_index, PRIVATE_PIXMAP) ||
-	    !etnaviv_CreateKey(&etnaviv_screen_index, PRIVATE_SCREEN))
+	    !etnaviv_CreateKey(&etnaviv_screen_index, PRIVATE_SCREEN) ||
+	    !etnaviv_CreateSizedKey(&etnaviv_gc_index, PRIVATE_GC,
+				    sizeof(struct etnaviv_gc_priv)))
 		return FALSE;
 
 	etnaviv->bufmgr = mgr;
@@ -924,6 +1160,8 @@ static Bool etnaviv_ScreenInit(ScreenPtr pScreen, struct drm_armada_bufmgr *mgr)
 	pScreen->DestroyPixmap = etnaviv_DestroyPixmap;
 	etnaviv->CreateGC = pScreen->CreateGC;
 	pScreen->CreateGC = etnaviv_CreateGC;
+	etnaviv->UnrealizeFont = pScreen->UnrealizeFont;
+	pScreen->UnrealizeFont = etnaviv_UnrealizeFont;
 	etnaviv->BitmapToRegion = pScreen->BitmapToRegion;
 	pScreen->BitmapToRegion = unaccel_BitmapToRegion;
 	etnaviv->BlockHandler = pScreen->BlockHandler;
@@ -1091,6 +1329,26 @@ static int etnaviv_export_name(ScreenPtr pScreen, uint32_t name)
 	return fd;
 }
 
+static int etnaviv_export_dmabuf(ScreenPtr pScreen, PixmapPtr pPixmap)
+{
+	struct etnaviv *etnaviv = etnaviv_get_screen_priv(pScreen);
+	struct etnaviv_pixmap *vPix = etnaviv_get_pixmap_priv(pPixmap);
+	int fd;
+
+	if (!vPix || !vPix->etna_bo)
+		return -1;
+
+	fd = etna_bo_to_dmabuf(etnaviv->conn, vPix->etna_bo);
+	if (fd < 0) {
+		xf86DrvMsg(etnaviv->scrnIndex, X_ERROR,
+			   "etna_bo_to_dmabuf failed: %s\n",
+			   strerror(errno));
+		return -1;
+	}
+
+	return fd;
+}
+
 const struct armada_accel_ops etnaviv_ops = {
 	.pre_init	= etnaviv_pre_init,
 	.screen_init	= etnaviv_ScreenInit,
@@ -1100,4 +1358,5 @@ const struct armada_accel_ops etnaviv_ops = {
 	.free_pixmap	= etnaviv_free_pixmap,
 	.xv_init	= etnaviv_xv_init,
 	.export_name	= etnaviv_export_name,
+	.export_dmabuf	= etnaviv_export_dmabuf,
 };
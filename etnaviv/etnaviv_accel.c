@@ -14,16 +14,19 @@
 #endif
 
 #include <errno.h>
+#include <sys/mman.h>
 #include <unistd.h>
 
 #ifdef HAVE_DIX_CONFIG_H
 #include "dix-config.h"
 #endif
+#include "dixfontstr.h"
 #include "fb.h"
 #include "gcstruct.h"
 #include "xf86.h"
 
 #include "boxutil.h"
+#include "fbutil.h"
 #include "pixmaputil.h"
 #include "prefetch.h"
 #include "unaccel.h"
@@ -40,13 +43,13 @@
 #include <etnaviv/state_2d.xml.h>
 #include "etnaviv_compat.h"
 
-void etnaviv_batch_wait_commit(struct etnaviv *etnaviv,
-	struct etnaviv_pixmap *vPix)
+void etnaviv_batch_wait_fence(struct etnaviv *etnaviv,
+	struct etnaviv_fence *f)
 {
 	uint32_t id;
 	int ret;
 
-	switch (vPix->fence.state) {
+	switch (f->state) {
 	case B_NONE:
 		return;
 
@@ -56,10 +59,10 @@ void etnaviv_batch_wait_commit(struct etnaviv *etnaviv,
 
 	case B_FENCED:
 		/*
-		 * The pixmap is part of a batch which has been submitted,
+		 * The object is part of a batch which has been submitted,
 		 * so we must wait for the batch to complete.
 		 */
-		id = vPix->fence.id;
+		id = f->id;
 
 		ret = viv_fence_finish(etnaviv->conn, id, VIV_WAIT_INDEFINITE);
 		if (ret != VIV_STATUS_OK)
@@ -70,6 +73,12 @@ void etnaviv_batch_wait_commit(struct etnaviv *etnaviv,
 	}
 }
 
+void etnaviv_batch_wait_commit(struct etnaviv *etnaviv,
+	struct etnaviv_pixmap *vPix)
+{
+	etnaviv_batch_wait_fence(etnaviv, &vPix->fence);
+}
+
 static void etnaviv_batch_add(struct etnaviv *etnaviv,
 	struct etnaviv_pixmap *vPix)
 {
@@ -83,11 +92,25 @@ void etnaviv_batch_start(struct etnaviv *etnaviv,
 	if (op->src.pixmap)
 		etnaviv_batch_add(etnaviv, op->src.pixmap);
 
-	etnaviv_batch_add(etnaviv, op->dst.pixmap);
+	if (op->dst.pixmap)
+		etnaviv_batch_add(etnaviv, op->dst.pixmap);
 
 	etnaviv_de_start(etnaviv, op);
 }
 
+void etnaviv_batch_vr_op(struct etnaviv *etnaviv, struct etnaviv_vr_op *op,
+	const BoxRec *dst, uint32_t x1, uint32_t y1,
+	const BoxRec *boxes, size_t n)
+{
+	if (op->src.pixmap)
+		etnaviv_batch_add(etnaviv, op->src.pixmap);
+
+	if (op->dst.pixmap)
+		etnaviv_batch_add(etnaviv, op->dst.pixmap);
+
+	etnaviv_vr_op(etnaviv, op, dst, x1, y1, boxes, n);
+}
+
 static void etnaviv_blit_clipped(struct etnaviv *etnaviv,
 	struct etnaviv_de_op *op, const BoxRec *pbox, size_t nbox)
 {
@@ -275,15 +298,10 @@ static const uint8_t etnaviv_fill_rop[] = {
 	/* GXset          */  0xff		// ROP_WHITE
 };
 
-static uint32_t etnaviv_fg_col(struct etnaviv *etnaviv, GCPtr pGC)
+static uint32_t etnaviv_pixel_col(struct etnaviv *etnaviv, GCPtr pGC,
+	uint32_t pixel)
 {
-	uint32_t pixel, colour;
-
-	if (pGC->fillStyle == FillTiled)
-		pixel = pGC->tileIsPixel ? pGC->tile.pixel :
-			get_first_pixel(&pGC->tile.pixmap->drawable);
-	else
-		pixel = pGC->fgPixel;
+	uint32_t colour;
 
 	/* With PE1.0, this is the pixel value, but PE2.0, it must be ARGB */
 	if (!VIV_FEATURE(etnaviv->conn, chipMinorFeatures0, 2DPE20))
@@ -315,15 +333,250 @@ static uint32_t etnaviv_fg_col(struct etnaviv *etnaviv, GCPtr pGC)
 	return colour;
 }
 
-static void etnaviv_init_fill(struct etnaviv *etnaviv,
-	struct etnaviv_de_op *op, GCPtr pGC)
+static uint32_t etnaviv_fg_col(struct etnaviv *etnaviv, GCPtr pGC)
+{
+	uint32_t pixel;
+
+	if (pGC->fillStyle == FillTiled)
+		pixel = pGC->tileIsPixel ? pGC->tile.pixel :
+			get_first_pixel(&pGC->tile.pixmap->drawable);
+	else
+		pixel = pGC->fgPixel;
+
+	return etnaviv_pixel_col(etnaviv, pGC, pixel);
+}
+
+/*
+ * Fill the destination box with copies of the tile, aligned to tile_off.
+ * The caller must have started the operation.
+ */
+static void etnaviv_tile_box(struct etnaviv *etnaviv,
+	const struct etnaviv_de_op *op, const BoxRec *pBox, xPoint tile_off,
+	int tile_w, int tile_h)
+{
+	xPoint tile_origin;
+	int dst_y, height, tile_y;
+
+	dst_y = pBox->y1;
+	height = pBox->y2 - dst_y;
+	modulus(dst_y - tile_off.y, tile_h, tile_y);
+
+	tile_origin.y = tile_y;
+
+	while (height > 0) {
+		int dst_x, width, tile_x, h;
+
+		dst_x = pBox->x1;
+		width = pBox->x2 - dst_x;
+		modulus(dst_x - tile_off.x, tile_w, tile_x);
+
+		tile_origin.x = tile_x;
+
+		h = tile_h - tile_origin.y;
+		if (h > height)
+			h = height;
+		height -= h;
+
+		while (width > 0) {
+			BoxRec dst;
+			int w;
+
+			w = tile_w - tile_origin.x;
+			if (w > width)
+				w = width;
+			width -= w;
+
+			box_init(&dst, dst_x, dst_y, w, h);
+			etnaviv_de_op_src_origin(etnaviv, op, tile_origin,
+						 &dst);
+
+			dst_x += w;
+			tile_origin.x = 0;
+		}
+		dst_y += h;
+		tile_origin.y = 0;
+	}
+}
+
+Bool etnaviv_GC_tile_is_pattern(GCPtr pGC)
+{
+	return pGC->fillStyle == FillTiled && !pGC->tileIsPixel &&
+	       pGC->tile.pixmap->drawable.width == PATTERN_SIZE &&
+	       pGC->tile.pixmap->drawable.height == PATTERN_SIZE;
+}
+
+/*
+ * Copy an 8x8 tile into the pattern buffer.  The hardware aligns the
+ * pattern to the destination coordinates, so rotate the tile such that
+ * it is aligned to the tile origin in the destination.
+ */
+static Bool etnaviv_init_pattern(struct etnaviv *etnaviv,
+	struct etnaviv_de_op *op, GCPtr pGC, DrawablePtr pDrawable)
+{
+	static const BoxRec pattern_box = { 0, 0, PATTERN_SIZE, PATTERN_SIZE };
+	PixmapPtr pTile = pGC->tile.pixmap;
+	struct etnaviv_de_op pat;
+	unsigned int pitch;
+	xPoint tile_off;
+
+	if (!etnaviv->pattern_bo ||
+	    !etnaviv_init_src_pixmap(etnaviv, &pat, pTile))
+		return FALSE;
+
+	pitch = PATTERN_SIZE * pTile->drawable.bitsPerPixel / 8;
+
+	pat.dst = INIT_BLIT_BO(etnaviv->pattern_bo, pitch,
+			       pat.src.format, ZERO_OFFSET);
+	pat.blend_op = NULL;
+	pat.clip = &pattern_box;
+	pat.src_origin_mode = SRC_ORIGIN_NONE;
+	pat.rop = 0xcc;
+	pat.cmd = VIVS_DE_DEST_CONFIG_COMMAND_BIT_BLT;
+	pat.brush = FALSE;
+
+	tile_off.x = pDrawable->x + pGC->patOrg.x + op->dst.offset.x;
+	tile_off.y = pDrawable->y + pGC->patOrg.y + op->dst.offset.y;
+
+	etnaviv_batch_start(etnaviv, &pat);
+	etnaviv_tile_box(etnaviv, &pat, &pattern_box, tile_off,
+			 PATTERN_SIZE, PATTERN_SIZE);
+	etnaviv_de_end(etnaviv);
+
+	op->pattern = pat.dst;
+
+	return TRUE;
+}
+
+/*
+ * Set up a monochrome pattern brush from the GC stipple, rotated so that
+ * it is aligned to the stipple origin in the destination.  Transparent
+ * stipples leave the destination untouched where the stipple is clear.
+ */
+static void etnaviv_init_stipple(struct etnaviv *etnaviv,
+	struct etnaviv_de_op *op, GCPtr pGC, DrawablePtr pDrawable)
+{
+	struct etnaviv_gc_priv *priv = etnaviv_get_gc_priv(pGC);
+	struct etnaviv_stipple *brush = &priv->brush;
+	unsigned int x, y, i;
+
+	x = (pDrawable->x + pGC->patOrg.x + op->dst.offset.x) & 7;
+	y = (pDrawable->y + pGC->patOrg.y + op->dst.offset.y) & 7;
+
+	for (i = 0; i < 8; i++) {
+		uint8_t row = priv->stipple[(i - y) & 7];
+
+		brush->mask[i] = row >> x | row << (8 - x);
+	}
+
+	if (pGC->fillStyle == FillOpaqueStippled) {
+		brush->bg_colour = etnaviv_pixel_col(etnaviv, pGC,
+						     pGC->bgPixel);
+		brush->bg_rop = op->rop;
+	} else {
+		brush->bg_colour = 0;
+		brush->bg_rop = 0xaa;
+	}
+
+	op->stipple = brush;
+}
+
+static Bool etnaviv_init_fill(struct etnaviv *etnaviv,
+	struct etnaviv_de_op *op, GCPtr pGC, DrawablePtr pDrawable)
 {
 	op->src = INIT_BLIT_NULL;
 	op->blend_op = NULL;
 	op->src_origin_mode = SRC_ORIGIN_NONE;
 	op->rop = etnaviv_fill_rop[pGC->alu];
 	op->brush = TRUE;
+	op->pattern = INIT_BLIT_NULL;
+	op->stipple = NULL;
+
+	if (etnaviv_GC_tile_is_pattern(pGC))
+		return etnaviv_init_pattern(etnaviv, op, pGC, pDrawable);
+
+	if (pGC->fillStyle == FillStippled ||
+	    pGC->fillStyle == FillOpaqueStippled)
+		etnaviv_init_stipple(etnaviv, op, pGC, pDrawable);
+
 	op->fg_colour = etnaviv_fg_col(etnaviv, pGC);
+
+	return TRUE;
+}
+
+/*
+ * The 2D engine has no destination write mask, so a partial planemask
+ * is applied through the ROP, using a solid brush to select the planes
+ * to be modified; the other planes keep the destination.  Copies need
+ * only one pass, but solid fills already use the brush for their
+ * colour, so are drawn in up to two passes: one for the masked planes
+ * which are clear in the foreground pixel, and one for those which are
+ * set.  Passes which would leave the destination unchanged are omitted.
+ */
+static Bool etnaviv_full_planemask(GCPtr pGC)
+{
+	unsigned long fullmask = FbFullMask(pGC->depth);
+
+	return (pGC->planemask & fullmask) == fullmask;
+}
+
+static unsigned int etnaviv_fill_passes(struct etnaviv *etnaviv,
+	const struct etnaviv_de_op *op, GCPtr pGC,
+	struct etnaviv_fill_pass *pass)
+{
+	unsigned long mask = pGC->planemask & FbFullMask(pGC->depth);
+	unsigned long fg = pGC->fgPixel;
+	unsigned int n = 0;
+
+	if (etnaviv_full_planemask(pGC)) {
+		pass[0].colour = op->fg_colour;
+		pass[0].rop = op->rop;
+		return 1;
+	}
+
+	/* The low nibble of the ROP is the result for a clear brush bit */
+	if (mask & ~fg && (op->rop & 0x0f) != 0x0a) {
+		pass[n].colour = etnaviv_pixel_col(etnaviv, pGC, mask & ~fg);
+		pass[n].rop = (op->rop & 0x0f) << 4 | 0x0a;
+		n++;
+	}
+	if (mask & fg && (op->rop & 0xf0) != 0xa0) {
+		pass[n].colour = etnaviv_pixel_col(etnaviv, pGC, mask & fg);
+		pass[n].rop = (op->rop & 0xf0) | 0x0a;
+		n++;
+	}
+
+	return n;
+}
+
+/* Draw boxes with a solid fill as a separate operation for each pass */
+static void etnaviv_fill_boxes(struct etnaviv *etnaviv,
+	struct etnaviv_de_op *op, const struct etnaviv_fill_pass *pass,
+	unsigned int npass, const BoxRec *boxes, size_t n)
+{
+	unsigned int i;
+
+	for (i = 0; i < npass; i++) {
+		op->fg_colour = pass[i].colour;
+		op->rop = pass[i].rop;
+
+		etnaviv_batch_start(etnaviv, op);
+		etnaviv_de_op(etnaviv, op, boxes, n);
+		etnaviv_de_end(etnaviv);
+	}
+}
+
+static void etnaviv_copy_planemask(struct etnaviv *etnaviv,
+	struct etnaviv_de_op *op, GCPtr pGC)
+{
+	if (!pGC || etnaviv_full_planemask(pGC))
+		return;
+
+	op->brush = TRUE;
+	op->fg_colour = etnaviv_pixel_col(etnaviv, pGC,
+				pGC->planemask & FbFullMask(pGC->depth));
+	op->pattern = INIT_BLIT_NULL;
+	op->stipple = NULL;
+	op->rop = (op->rop & 0xf0) | 0x0a;
 }
 
 static const uint8_t etnaviv_copy_rop[] = {
@@ -345,37 +598,195 @@ static const uint8_t etnaviv_copy_rop[] = {
 	/* GXset          */  0xff		// ROP_WHITE
 };
 
+/*
+ * Find the first rectangle of the clip band containing line y.  The
+ * region rectangles are sorted in y-x bands, so their y2 coordinates
+ * are in ascending order.
+ */
+static const BoxRec *etnaviv_clip_band(const BoxRec *rects, int nrects,
+	int y)
+{
+	int lo = 0, hi = nrects;
+
+	while (lo < hi) {
+		int mid = (lo + hi) / 2;
+
+		if (rects[mid].y2 <= y)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	if (lo == nrects || rects[lo].y1 > y)
+		return NULL;
+
+	return &rects[lo];
+}
+
+static void etnaviv_span_flush(struct etnaviv *etnaviv,
+	struct etnaviv_span_arena *arena)
+{
+	/*
+	 * Each pass is a complete batch: mi may draw parts of the shape
+	 * through other GC ops between our callbacks, and those set up
+	 * their own batches, so nothing may be left open across them.
+	 */
+	etnaviv_fill_boxes(etnaviv, &arena->op, arena->pass, arena->npass,
+			   arena->box, arena->nbox);
+
+	/* Emitted boxes can no longer be extended */
+	arena->nbox = arena->nprev = arena->ncur = 0;
+}
+
+static Bool etnaviv_span_begin(struct etnaviv *etnaviv, DrawablePtr pDrawable,
+	GCPtr pGC)
+{
+	struct etnaviv_span_arena *arena = &etnaviv->span_arena;
+
+	if (!etnaviv_init_dst_drawable(etnaviv, &arena->op, pDrawable))
+		return FALSE;
+
+	if (!etnaviv_init_fill(etnaviv, &arena->op, pGC, pDrawable))
+		return FALSE;
+	arena->op.clip = RegionExtents(fbGetCompositeClip(pGC));
+	arena->op.cmd = VIVS_DE_DEST_CONFIG_COMMAND_BIT_BLT;
+	arena->npass = etnaviv_fill_passes(etnaviv, &arena->op, pGC,
+					   arena->pass);
+
+	arena->band = NULL;
+	arena->prev = arena->line[0];
+	arena->cur = arena->line[1];
+	arena->nbox = arena->nprev = arena->ncur = 0;
+	arena->line_y = 0;
+
+	return TRUE;
+}
+
+static void etnaviv_span_end(struct etnaviv *etnaviv)
+{
+	struct etnaviv_span_arena *arena = &etnaviv->span_arena;
+
+	if (arena->nbox)
+		etnaviv_span_flush(etnaviv, arena);
+}
+
+/*
+ * Clip a span against the band of the clip region containing its line,
+ * and add the pieces to the arena, merging them with boxes ending on
+ * the line above where they have the same x extent.
+ */
+static void etnaviv_span_add(struct etnaviv *etnaviv, RegionPtr clip,
+	int x1, int x2, int y)
+{
+	struct etnaviv_span_arena *arena = &etnaviv->span_arena;
+	const BoxRec *rects = RegionRects(clip);
+	const BoxRec *rects_end = rects + RegionNumRects(clip);
+	const BoxRec *band = arena->band, *b;
+
+	/* Spans are normally sorted, so the band is usually reused */
+	if (!band || y < band->y1 || y >= band->y2) {
+		band = etnaviv_clip_band(rects, rects_end - rects, y);
+		if (!band)
+			return;
+		arena->band = band;
+	}
+
+	if (y != arena->line_y) {
+		if (y == arena->line_y + 1) {
+			unsigned short *tmp = arena->prev;
+
+			arena->prev = arena->cur;
+			arena->cur = tmp;
+			arena->nprev = arena->ncur;
+		} else {
+			arena->nprev = 0;
+		}
+		arena->ncur = 0;
+		arena->line_y = y;
+	}
+
+	for (b = band; b < rects_end && b->y1 == band->y1 && b->x1 < x2; b++) {
+		int l = maxt(x1, b->x1);
+		int r = mint(x2, b->x2);
+		unsigned int i;
+
+		if (l >= r)
+			continue;
+
+		/* Extend a box ending on the previous line */
+		for (i = 0; i < arena->nprev; i++) {
+			BoxRec *p = &arena->box[arena->prev[i]];
+
+			if (p->x1 == l && p->x2 == r && p->y2 == y) {
+				p->y2 = y + 1;
+				break;
+			}
+		}
+
+		if (i < arena->nprev) {
+			arena->cur[arena->ncur++] = arena->prev[i];
+			continue;
+		}
+
+		if (arena->nbox == SPAN_ARENA_SIZE)
+			etnaviv_span_flush(etnaviv, arena);
+
+		box_init(&arena->box[arena->nbox], l, y, r - l, 1);
+		arena->cur[arena->ncur++] = arena->nbox++;
+	}
+}
+
+static Bool etnaviv_span_batching(struct etnaviv *etnaviv,
+	DrawablePtr pDrawable, GCPtr pGC)
+{
+	return etnaviv->span_arena.drawable == pDrawable &&
+	       etnaviv->span_arena.gc == pGC;
+}
+
+/*
+ * Shapes (polygons and arcs) are rasterised by mi into many calls to
+ * FillSpans or PolyPoint.  Collect them all into a single operation.
+ * The caller must ensure that mi will not change the GC or access the
+ * drawable in any other way while the shape is being drawn.
+ */
+Bool etnaviv_accel_shape_begin(DrawablePtr pDrawable, GCPtr pGC)
+{
+	struct etnaviv *etnaviv = etnaviv_get_screen_priv(pDrawable->pScreen);
+
+	if (etnaviv->span_arena.drawable ||
+	    !etnaviv_span_begin(etnaviv, pDrawable, pGC))
+		return FALSE;
+
+	etnaviv->span_arena.drawable = pDrawable;
+	etnaviv->span_arena.gc = pGC;
+
+	return TRUE;
+}
+
+void etnaviv_accel_shape_end(DrawablePtr pDrawable)
+{
+	struct etnaviv *etnaviv = etnaviv_get_screen_priv(pDrawable->pScreen);
+
+	etnaviv_span_end(etnaviv);
+
+	etnaviv->span_arena.drawable = NULL;
+	etnaviv->span_arena.gc = NULL;
+}
+
 Bool etnaviv_accel_FillSpans(DrawablePtr pDrawable, GCPtr pGC, int n,
 	DDXPointPtr ppt, int *pwidth, int fSorted)
 {
 	struct etnaviv *etnaviv = etnaviv_get_screen_priv(pDrawable->pScreen);
-	struct etnaviv_de_op op;
 	RegionPtr clip = fbGetCompositeClip(pGC);
-	int nclip;
-	BoxRec *boxes, *b;
-	size_t sz;
+	Bool batching;
 
 	assert(pGC->miTranslate);
 
 	if (RegionNumRects(clip) == 0)
 		return TRUE;
 
-	if (!etnaviv_init_dst_drawable(etnaviv, &op, pDrawable))
-		return FALSE;
-
-	etnaviv_init_fill(etnaviv, &op, pGC);
-	op.clip = RegionExtents(clip);
-	op.cmd = VIVS_DE_DEST_CONFIG_COMMAND_LINE;
-
-	nclip = RegionNumRects(clip);
-	sz = sizeof(BoxRec) * n * nclip;
-
-	/* If we overflow, fallback.  We could do better here. */
-	if (sz / nclip != sizeof(BoxRec) * n)
-		return FALSE;
-
-	boxes = malloc(sz);
-	if (!boxes)
+	batching = etnaviv_span_batching(etnaviv, pDrawable, pGC);
+	if (!batching && !etnaviv_span_begin(etnaviv, pDrawable, pGC))
 		return FALSE;
 
 	prefetch(ppt);
@@ -383,55 +794,102 @@ Bool etnaviv_accel_FillSpans(DrawablePtr pDrawable, GCPtr pGC, int n,
 	prefetch(pwidth);
 	prefetch(pwidth + 8);
 
-	b = boxes;
-
 	while (n--) {
-		BoxPtr pBox;
-		int nBox, x, y, w;
-
 		prefetch(ppt + 16);
 		prefetch(pwidth + 16);
 
-		nBox = nclip;
-		pBox = RegionRects(clip);
-
-		y = ppt->y;
-		x = ppt->x;
-		w = *pwidth++;
-
-		do {
-			if (pBox->y1 <= y && pBox->y2 > y) {
-				int l, r;
-
-				l = x;
-				if (l < pBox->x1)
-					l = pBox->x1;
-				r = x + w;
-				if (r > pBox->x2)
-					r = pBox->x2;
-
-				if (l < r) {
-					b->x1 = l;
-					b->y1 = y;
-					b->x2 = r;
-					b->y2 = y;
-					b++;
-				}
-			}
-			pBox++;
-		} while (--nBox);
+		etnaviv_span_add(etnaviv, clip, ppt->x, ppt->x + *pwidth,
+				 ppt->y);
 		ppt++;
+		pwidth++;
 	}
 
-	if (b != boxes) {
-		etnaviv_batch_start(etnaviv, &op);
-		etnaviv_de_op(etnaviv, &op, boxes, b - boxes);
-		etnaviv_de_end(etnaviv);
+	if (!batching)
+		etnaviv_span_end(etnaviv);
+
+	return TRUE;
+}
+
+/*
+ * Wrap the client's image data (the request buffer or a MIT-SHM
+ * segment) in a user memory BO and blit directly from it.  The data
+ * only remains valid until the request completes, so we have to wait
+ * for the GPU before returning, so this is only worth doing for larger
+ * images.  The same applies to GetImage.
+ */
+#define PUTIMAGE_USERMEM_MIN	(256 * 1024)
+
+static Bool etnaviv_put_image_usermem(DrawablePtr pDrawable, GCPtr pGC,
+	int x, int y, int w, int h, char *bits)
+{
+	struct etnaviv *etnaviv = etnaviv_get_screen_priv(pDrawable->pScreen);
+	struct etnaviv_usermem_node *unode;
+	struct etnaviv_de_op op;
+	struct etna_bo *usr;
+	unsigned int cpp = pDrawable->bitsPerPixel / 8;
+	unsigned int pitch = PixmapBytePad(w, pDrawable->depth);
+	size_t xoff = (uintptr_t)bits & VIVANTE_ALIGN_MASK;
+	RegionRec region;
+	BoxRec box;
+
+	if (pitch & 15 || xoff % cpp)
+		return FALSE;
+
+	box_init(&box, x + pDrawable->x, y + pDrawable->y, w, h);
+
+	RegionInit(&region, &box, 1);
+	RegionIntersect(&region, &region, fbGetCompositeClip(pGC));
+	if (!RegionNotEmpty(&region)) {
+		RegionUninit(&region);
+		return TRUE;
 	}
 
-	free(boxes);
+	if (!etnaviv_init_dst_drawable(etnaviv, &op, pDrawable))
+		goto fail;
+
+	unode = malloc(sizeof(*unode));
+	if (!unode)
+		goto fail;
+
+	usr = etna_bo_from_usermem_prot(etnaviv->conn, bits - xoff,
+					pitch * h + xoff, PROT_READ);
+	if (!usr) {
+		free(unode);
+		goto fail;
+	}
+
+	/* The memory belongs to the client, so only the BO is freed */
+	memset(unode, 0, sizeof(*unode));
+	unode->bo = usr;
+	etnaviv_add_freemem(etnaviv, unode);
+
+	op.src = INIT_BLIT_BO(usr, pitch, op.dst.format, ZERO_OFFSET);
+	op.src.offset.x = xoff / cpp - box.x1 - op.dst.offset.x;
+	op.src.offset.y = -box.y1 - op.dst.offset.y;
+	op.blend_op = NULL;
+	op.clip = RegionExtents(&region);
+	op.src_origin_mode = SRC_ORIGIN_RELATIVE;
+	op.rop = etnaviv_copy_rop[pGC->alu];
+	op.cmd = VIVS_DE_DEST_CONFIG_COMMAND_BIT_BLT;
+	op.brush = FALSE;
+	op.pattern = INIT_BLIT_NULL;
+	op.stipple = NULL;
+	etnaviv_copy_planemask(etnaviv, &op, pGC);
+
+	etnaviv_batch_start(etnaviv, &op);
+	etnaviv_de_op(etnaviv, &op, RegionRects(&region),
+		      RegionNumRects(&region));
+	etnaviv_de_end(etnaviv);
+
+	/* Wait for the blit, which also retires the BO */
+	etnaviv_commit(etnaviv, TRUE);
 
+	RegionUninit(&region);
 	return TRUE;
+
+ fail:
+	RegionUninit(&region);
+	return FALSE;
 }
 
 Bool etnaviv_accel_PutImage(DrawablePtr pDrawable, GCPtr pGC, int depth,
@@ -450,6 +908,11 @@ Bool etnaviv_accel_PutImage(DrawablePtr pDrawable, GCPtr pGC, int depth,
 	if (!(vPix->state & ST_GPU_RW))
 		return FALSE;
 
+	if (depth == pDrawable->depth && !leftPad &&
+	    PixmapBytePad(w, depth) * h >= PUTIMAGE_USERMEM_MIN &&
+	    etnaviv_put_image_usermem(pDrawable, pGC, x, y, w, h, bits))
+		return TRUE;
+
 	pTemp = pScreen->CreatePixmap(pScreen, w, h, pPix->drawable.depth,
 				      CREATE_PIXMAP_USAGE_GPU);
 	if (!pTemp)
@@ -472,13 +935,77 @@ Bool etnaviv_accel_PutImage(DrawablePtr pDrawable, GCPtr pGC, int depth,
 	return TRUE;
 }
 
-Bool etnaviv_accel_GetImage(DrawablePtr pDrawable, int x, int y, int w, int h,
-	unsigned int format, unsigned long planeMask, char *d)
+/*
+ * Blit directly into a user memory BO wrapping the client's buffer
+ * (the reply buffer or a MIT-SHM segment), and wait for the GPU.
+ * x and y are the source pixmap coordinates.
+ */
+static Bool etnaviv_get_image_usermem(struct etnaviv *etnaviv, PixmapPtr pPix,
+	int x, int y, int w, int h, char *d)
 {
-	ScreenPtr pScreen = pDrawable->pScreen;
-	struct etnaviv_pixmap *vPix;
-	PixmapPtr pPix, pTemp;
-	GCPtr gc;
+	struct etnaviv_usermem_node *unode;
+	struct etnaviv_de_op op;
+	struct etna_bo *usr;
+	unsigned int cpp = pPix->drawable.bitsPerPixel / 8;
+	unsigned int pitch = PixmapBytePad(w, pPix->drawable.depth);
+	size_t xoff = (uintptr_t)d & VIVANTE_ALIGN_MASK;
+	BoxRec box;
+
+	if (pitch & 15 || xoff % cpp)
+		return FALSE;
+
+	if (!etnaviv_init_src_pixmap(etnaviv, &op, pPix) ||
+	    !etnaviv_dst_format_valid(etnaviv, op.src.format))
+		return FALSE;
+
+	unode = malloc(sizeof(*unode));
+	if (!unode)
+		return FALSE;
+
+	usr = etna_bo_from_usermem_prot(etnaviv->conn, d - xoff,
+					pitch * h + xoff,
+					PROT_READ | PROT_WRITE);
+	if (!usr) {
+		free(unode);
+		return FALSE;
+	}
+
+	/* The memory belongs to the client, so only the BO is freed */
+	memset(unode, 0, sizeof(*unode));
+	unode->bo = usr;
+	etnaviv_add_freemem(etnaviv, unode);
+
+	box_init(&box, xoff / cpp, 0, w, h);
+
+	op.dst = INIT_BLIT_BO(usr, pitch, op.src.format, ZERO_OFFSET);
+	op.src.offset.x = x - box.x1;
+	op.src.offset.y = y;
+	op.blend_op = NULL;
+	op.clip = &box;
+	op.src_origin_mode = SRC_ORIGIN_RELATIVE;
+	op.rop = 0xcc;
+	op.cmd = VIVS_DE_DEST_CONFIG_COMMAND_BIT_BLT;
+	op.brush = FALSE;
+	op.pattern = INIT_BLIT_NULL;
+	op.stipple = NULL;
+
+	etnaviv_batch_start(etnaviv, &op);
+	etnaviv_de_op(etnaviv, &op, &box, 1);
+	etnaviv_de_end(etnaviv);
+
+	/* Wait for the blit, which also retires the BO */
+	etnaviv_commit(etnaviv, TRUE);
+
+	return TRUE;
+}
+
+Bool etnaviv_accel_GetImage(DrawablePtr pDrawable, int x, int y, int w, int h,
+	unsigned int format, unsigned long planeMask, char *d)
+{
+	ScreenPtr pScreen = pDrawable->pScreen;
+	struct etnaviv_pixmap *vPix;
+	PixmapPtr pPix, pTemp;
+	GCPtr gc;
 	xPoint src_offset;
 
 	pPix = drawable_pixmap_offset(pDrawable, &src_offset);
@@ -489,6 +1016,12 @@ Bool etnaviv_accel_GetImage(DrawablePtr pDrawable, int x, int y, int w, int h,
 	x += pDrawable->x + src_offset.x;
 	y += pDrawable->y + src_offset.y;
 
+	if (format == ZPixmap && fb_full_planemask(pDrawable, planeMask) &&
+	    PixmapBytePad(w, pDrawable->depth) * h >= PUTIMAGE_USERMEM_MIN &&
+	    etnaviv_get_image_usermem(etnaviv_get_screen_priv(pScreen), pPix,
+				      x, y, w, h, d))
+		return TRUE;
+
 	pTemp = pScreen->CreatePixmap(pScreen, w, h, pPix->drawable.depth,
 				      CREATE_PIXMAP_USAGE_GPU);
 	if (!pTemp)
@@ -561,6 +1094,7 @@ void etnaviv_accel_CopyNtoN(DrawablePtr pSrc, DrawablePtr pDst,
 	op.rop = etnaviv_copy_rop[pGC ? pGC->alu : GXcopy];
 	op.cmd = VIVS_DE_DEST_CONFIG_COMMAND_BIT_BLT;
 	op.brush = FALSE;
+	etnaviv_copy_planemask(etnaviv, &op, pGC);
 
 	etnaviv_batch_start(etnaviv, &op);
 	etnaviv_blit_clipped(etnaviv, &op, pBox, nBox);
@@ -583,10 +1117,31 @@ Bool etnaviv_accel_PolyPoint(DrawablePtr pDrawable, GCPtr pGC, int mode,
 	int i;
 	Bool overlap;
 
+	/* Points drawn while batching a shape are one pixel spans */
+	if (etnaviv_span_batching(etnaviv, pDrawable, pGC)) {
+		RegionPtr clip = fbGetCompositeClip(pGC);
+		int x = 0, y = 0;
+
+		for (i = 0; i < npt; i++) {
+			if (mode == CoordModePrevious) {
+				x += ppt[i].x;
+				y += ppt[i].y;
+			} else {
+				x = ppt[i].x;
+				y = ppt[i].y;
+			}
+			etnaviv_span_add(etnaviv, clip, x + pDrawable->x,
+					 x + pDrawable->x + 1,
+					 y + pDrawable->y);
+		}
+		return TRUE;
+	}
+
 	if (!etnaviv_init_dst_drawable(etnaviv, &op, pDrawable))
 		return FALSE;
 
-	etnaviv_init_fill(etnaviv, &op, pGC);
+	if (!etnaviv_init_fill(etnaviv, &op, pGC, pDrawable))
+		return FALSE;
 	op.cmd = VIVS_DE_DEST_CONFIG_COMMAND_BIT_BLT;
 
 	pBox = malloc(npt * sizeof *pBox);
@@ -621,12 +1176,15 @@ Bool etnaviv_accel_PolyPoint(DrawablePtr pDrawable, GCPtr pGC, int mode,
 	RegionIntersect(&region, &region, fbGetCompositeClip(pGC));
 
 	if (RegionNumRects(&region)) {
+		struct etnaviv_fill_pass pass[2];
+		unsigned int npass;
+
 		op.clip = RegionExtents(&region);
 
-		etnaviv_batch_start(etnaviv, &op);
-		etnaviv_de_op(etnaviv, &op, RegionRects(&region),
-			      RegionNumRects(&region));
-		etnaviv_de_end(etnaviv);
+		npass = etnaviv_fill_passes(etnaviv, &op, pGC, pass);
+		etnaviv_fill_boxes(etnaviv, &op, pass, npass,
+				   RegionRects(&region),
+				   RegionNumRects(&region));
 	}
 
 	RegionUninit(&region);
@@ -644,6 +1202,8 @@ Bool etnaviv_accel_PolyLines(DrawablePtr pDrawable, GCPtr pGC, int mode,
 	int nclip, i;
 	BoxRec *boxes, *b;
 	xSegment seg;
+	struct etnaviv_fill_pass pass[2];
+	unsigned int npass;
 
 	assert(pGC->miTranslate);
 
@@ -653,9 +1213,12 @@ Bool etnaviv_accel_PolyLines(DrawablePtr pDrawable, GCPtr pGC, int mode,
 	if (!etnaviv_init_dst_drawable(etnaviv, &op, pDrawable))
 		return FALSE;
 
-	etnaviv_init_fill(etnaviv, &op, pGC);
+	if (!etnaviv_init_fill(etnaviv, &op, pGC, pDrawable))
+		return FALSE;
 	op.cmd = VIVS_DE_DEST_CONFIG_COMMAND_LINE;
 
+	npass = etnaviv_fill_passes(etnaviv, &op, pGC, pass);
+
 	boxes = malloc(sizeof(BoxRec) * npt);
 	if (!boxes)
 		return FALSE;
@@ -711,9 +1274,8 @@ Bool etnaviv_accel_PolyLines(DrawablePtr pDrawable, GCPtr pGC, int mode,
 
 		if (b != boxes) {
 			op.clip = box;
-			etnaviv_batch_start(etnaviv, &op);
-			etnaviv_de_op(etnaviv, &op, boxes, b - boxes);
-			etnaviv_de_end(etnaviv);
+			etnaviv_fill_boxes(etnaviv, &op, pass, npass, boxes,
+					   b - boxes);
 		}
 	}
 
@@ -732,6 +1294,8 @@ Bool etnaviv_accel_PolySegment(DrawablePtr pDrawable, GCPtr pGC, int nseg,
 	int nclip, i;
 	BoxRec *boxes, *b;
 	bool last;
+	struct etnaviv_fill_pass pass[2];
+	unsigned int npass;
 
 	assert(pGC->miTranslate);
 
@@ -741,9 +1305,12 @@ Bool etnaviv_accel_PolySegment(DrawablePtr pDrawable, GCPtr pGC, int nseg,
 	if (!etnaviv_init_dst_drawable(etnaviv, &op, pDrawable))
 		return FALSE;
 
-	etnaviv_init_fill(etnaviv, &op, pGC);
+	if (!etnaviv_init_fill(etnaviv, &op, pGC, pDrawable))
+		return FALSE;
 	op.cmd = VIVS_DE_DEST_CONFIG_COMMAND_LINE;
 
+	npass = etnaviv_fill_passes(etnaviv, &op, pGC, pass);
+
 	last = pGC->capStyle != CapNotLast;
 
 	boxes = malloc(sizeof(BoxRec) * nseg * (1 + last));
@@ -788,9 +1355,8 @@ Bool etnaviv_accel_PolySegment(DrawablePtr pDrawable, GCPtr pGC, int nseg,
 
 		if (b != boxes) {
 			op.clip = box;
-			etnaviv_batch_start(etnaviv, &op);
-			etnaviv_de_op(etnaviv, &op, boxes, b - boxes);
-			etnaviv_de_end(etnaviv);
+			etnaviv_fill_boxes(etnaviv, &op, pass, npass, boxes,
+					   b - boxes);
 		}
 	}
 
@@ -799,14 +1365,283 @@ Bool etnaviv_accel_PolySegment(DrawablePtr pDrawable, GCPtr pGC, int nseg,
 	return TRUE;
 }
 
+/*
+ * Add the pixels of a horizontal or vertical zero-width line which fall
+ * in dashes of the given parity (0 for on dashes, 1 for off dashes) to
+ * the span arena, advancing the dash state by len pixels.
+ */
+static void etnaviv_dash_line(struct etnaviv *etnaviv, GCPtr pGC,
+	RegionPtr clip, const xSegment *seg, int len, int parity,
+	int *dash_index, int *dash_offset)
+{
+	int dx = seg->x2 > seg->x1 ? 1 : seg->x2 < seg->x1 ? -1 : 0;
+	int dy = seg->y2 > seg->y1 ? 1 : seg->y2 < seg->y1 ? -1 : 0;
+	int p, run;
+
+	for (p = 0; p < len; p += run) {
+		run = mint(pGC->dash[*dash_index] - *dash_offset, len - p);
+
+		if ((*dash_index & 1) == parity) {
+			int a = p, b = p + run - 1;
+
+			if (dy == 0) {
+				a = seg->x1 + dx * a;
+				b = seg->x1 + dx * b;
+				etnaviv_span_add(etnaviv, clip, mint(a, b),
+						 maxt(a, b) + 1, seg->y1);
+			} else {
+				int y;
+
+				a = seg->y1 + dy * a;
+				b = seg->y1 + dy * b;
+				for (y = mint(a, b); y <= maxt(a, b); y++)
+					etnaviv_span_add(etnaviv, clip, seg->x1,
+							 seg->x1 + 1, y);
+			}
+		}
+
+		miStepDash(run, dash_index, pGC->dash, pGC->numInDashList,
+			   dash_offset);
+	}
+}
+
+/*
+ * Draw zero-width dashed horizontal and vertical segments, one batched
+ * operation for the on dashes and, for double dashed lines, one for
+ * the off dashes.  If restart is set, the dash pattern restarts at
+ * each segment, otherwise it continues from one segment to the next.
+ */
+static Bool etnaviv_dash_segments(DrawablePtr pDrawable, GCPtr pGC,
+	const xSegment *segs, int nseg, Bool restart, Bool last)
+{
+	struct etnaviv *etnaviv = etnaviv_get_screen_priv(pDrawable->pScreen);
+	RegionPtr clip = fbGetCompositeClip(pGC);
+	int parity, nparity, i;
+
+	/* The off dashes change the brush colour */
+	if (!etnaviv_full_planemask(pGC))
+		return FALSE;
+
+	nparity = pGC->lineStyle == LineDoubleDash ? 2 : 1;
+
+	for (parity = 0; parity < nparity; parity++) {
+		int dash_index = 0, dash_offset = 0;
+
+		if (!etnaviv_span_begin(etnaviv, pDrawable, pGC))
+			return FALSE;
+
+		if (parity)
+			etnaviv->span_arena.op.fg_colour =
+				etnaviv_pixel_col(etnaviv, pGC, pGC->bgPixel);
+
+		for (i = 0; i < nseg; i++) {
+			const xSegment *seg = &segs[i];
+			int len;
+
+			if (i == 0 || restart) {
+				dash_index = dash_offset = 0;
+				miStepDash(pGC->dashOffset, &dash_index,
+					   pGC->dash, pGC->numInDashList,
+					   &dash_offset);
+			}
+
+			len = maxt(abs(seg->x2 - seg->x1),
+				   abs(seg->y2 - seg->y1));
+			if (last && (restart || i == nseg - 1))
+				len += 1;
+
+			etnaviv_dash_line(etnaviv, pGC, clip, seg, len, parity,
+					  &dash_index, &dash_offset);
+		}
+
+		etnaviv_span_end(etnaviv);
+	}
+
+	return TRUE;
+}
+
+Bool etnaviv_accel_PolyLinesDash(DrawablePtr pDrawable, GCPtr pGC, int mode,
+	int npt, DDXPointPtr ppt)
+{
+	struct etnaviv *etnaviv = etnaviv_get_screen_priv(pDrawable->pScreen);
+	xSegment *segs;
+	Bool last, ret;
+	int i, x, y;
+
+	assert(pGC->miTranslate);
+
+	if (npt < 2 || etnaviv->span_arena.drawable)
+		return FALSE;
+
+	if (RegionNumRects(fbGetCompositeClip(pGC)) == 0)
+		return TRUE;
+
+	segs = malloc(sizeof(*segs) * (npt - 1));
+	if (!segs)
+		return FALSE;
+
+	x = ppt[0].x + pDrawable->x;
+	y = ppt[0].y + pDrawable->y;
+	for (i = 1; i < npt; i++) {
+		segs[i - 1].x1 = x;
+		segs[i - 1].y1 = y;
+		if (mode == CoordModePrevious) {
+			x += ppt[i].x;
+			y += ppt[i].y;
+		} else {
+			x = ppt[i].x + pDrawable->x;
+			y = ppt[i].y + pDrawable->y;
+		}
+		segs[i - 1].x2 = x;
+		segs[i - 1].y2 = y;
+
+		if (x != segs[i - 1].x1 && y != segs[i - 1].y1) {
+			free(segs);
+			return FALSE;
+		}
+	}
+
+	/* A closed polyline does not draw its first point twice */
+	last = pGC->capStyle != CapNotLast &&
+	       (npt == 2 || x != segs[0].x1 || y != segs[0].y1);
+
+	ret = etnaviv_dash_segments(pDrawable, pGC, segs, npt - 1, FALSE, last);
+
+	free(segs);
+
+	return ret;
+}
+
+Bool etnaviv_accel_PolySegmentDash(DrawablePtr pDrawable, GCPtr pGC, int nseg,
+	xSegment *pSeg)
+{
+	struct etnaviv *etnaviv = etnaviv_get_screen_priv(pDrawable->pScreen);
+	xSegment *segs;
+	Bool ret;
+	int i;
+
+	assert(pGC->miTranslate);
+
+	if (etnaviv->span_arena.drawable)
+		return FALSE;
+
+	if (RegionNumRects(fbGetCompositeClip(pGC)) == 0)
+		return TRUE;
+
+	segs = malloc(sizeof(*segs) * nseg);
+	if (!segs)
+		return FALSE;
+
+	for (i = 0; i < nseg; i++) {
+		if (pSeg[i].x1 != pSeg[i].x2 && pSeg[i].y1 != pSeg[i].y2) {
+			free(segs);
+			return FALSE;
+		}
+
+		segs[i].x1 = pSeg[i].x1 + pDrawable->x;
+		segs[i].y1 = pSeg[i].y1 + pDrawable->y;
+		segs[i].x2 = pSeg[i].x2 + pDrawable->x;
+		segs[i].y2 = pSeg[i].y2 + pDrawable->y;
+	}
+
+	ret = etnaviv_dash_segments(pDrawable, pGC, segs, nseg, TRUE,
+				    pGC->capStyle != CapNotLast);
+
+	free(segs);
+
+	return ret;
+}
+
+/*
+ * Wide solid horizontal and vertical segments without round caps are
+ * exactly rectangles, computed in the same way as miWideSegment().
+ */
+Bool etnaviv_accel_PolySegmentWide(DrawablePtr pDrawable, GCPtr pGC,
+	int nseg, xSegment *pSeg)
+{
+	struct etnaviv *etnaviv = etnaviv_get_screen_priv(pDrawable->pScreen);
+	int lw = pGC->lineWidth, lw_l = lw >> 1, lw_r = (lw + 1) >> 1;
+	Bool project = pGC->capStyle == CapProjecting;
+	xRectangle *rects, *r;
+	int i;
+
+	if (pGC->capStyle == CapRound || etnaviv->span_arena.drawable)
+		return FALSE;
+
+	for (i = 0; i < nseg; i++)
+		if (pSeg[i].x1 != pSeg[i].x2 && pSeg[i].y1 != pSeg[i].y2)
+			return FALSE;
+
+	rects = malloc(sizeof(*rects) * nseg);
+	if (!rects)
+		return FALSE;
+
+	for (r = rects, i = 0; i < nseg; i++) {
+		int x1, y1, x2, y2;
+
+		if (pSeg[i].y1 == pSeg[i].y2) {
+			x1 = mint(pSeg[i].x1, pSeg[i].x2);
+			x2 = maxt(pSeg[i].x1, pSeg[i].x2);
+			if (project) {
+				x1 -= lw_l;
+				x2 += lw_r;
+			}
+			y1 = pSeg[i].y1 - lw_l;
+			y2 = y1 + lw;
+		} else {
+			y1 = mint(pSeg[i].y1, pSeg[i].y2);
+			y2 = maxt(pSeg[i].y1, pSeg[i].y2);
+			if (project) {
+				y1 -= lw_l;
+				y2 += lw_r;
+			}
+			x1 = pSeg[i].x1 - lw_l;
+			x2 = x1 + lw;
+		}
+
+		if (x1 == x2 || y1 == y2)
+			continue;
+
+		r->x = x1;
+		r->y = y1;
+		r->width = x2 - x1;
+		r->height = y2 - y1;
+		r++;
+	}
+
+	if (r != rects)
+		pGC->ops->PolyFillRect(pDrawable, pGC, r - rects, rects);
+
+	free(rects);
+
+	return TRUE;
+}
+
+/*
+ * Draw boxes which have been clipped to the clip extents.  Complex clips
+ * are applied by the hardware, drawing the boxes once per clip rectangle.
+ */
+static void etnaviv_de_op_region(struct etnaviv *etnaviv,
+	const struct etnaviv_de_op *op, RegionPtr clip, const BoxRec *boxes,
+	size_t n)
+{
+	if (RegionNumRects(clip) == 1)
+		etnaviv_de_op(etnaviv, op, boxes, n);
+	else
+		etnaviv_de_op_clip_rects(etnaviv, op, RegionRects(clip),
+					 RegionNumRects(clip), boxes, n);
+}
+
 Bool etnaviv_accel_PolyFillRectSolid(DrawablePtr pDrawable, GCPtr pGC, int n,
 	xRectangle * prect)
 {
 	struct etnaviv *etnaviv = etnaviv_get_screen_priv(pDrawable->pScreen);
 	struct etnaviv_de_op op;
+	struct etnaviv_fill_pass pass[2];
 	RegionPtr clip = fbGetCompositeClip(pGC);
-	BoxRec boxes[VIVANTE_MAX_2D_RECTS], *box;
-	int nclip, nb, chunk;
+	BoxRec boxes[VIVANTE_MAX_2D_RECTS];
+	unsigned int npass, p;
+	int nb, chunk;
 
 	if (RegionNumRects(clip) == 0)
 		return TRUE;
@@ -817,51 +1652,113 @@ Bool etnaviv_accel_PolyFillRectSolid(DrawablePtr pDrawable, GCPtr pGC, int n,
 	prefetch(prect);
 	prefetch(prect + 4);
 
-	etnaviv_init_fill(etnaviv, &op, pGC);
+	if (!etnaviv_init_fill(etnaviv, &op, pGC, pDrawable))
+		return FALSE;
 	op.clip = RegionExtents(clip);
 	op.cmd = VIVS_DE_DEST_CONFIG_COMMAND_BIT_BLT;
 
-	etnaviv_batch_start(etnaviv, &op);
+	npass = etnaviv_fill_passes(etnaviv, &op, pGC, pass);
 
-	chunk = VIVANTE_MAX_2D_RECTS;
-	nb = 0;
-	while (n--) {
-		BoxRec full_rect;
+	for (p = 0; p < npass; p++) {
+		xRectangle *r = prect;
+		int i = n;
+
+		op.fg_colour = pass[p].colour;
+		op.rop = pass[p].rop;
+
+		etnaviv_batch_start(etnaviv, &op);
 
-		prefetch (prect + 8);
+		chunk = VIVANTE_MAX_2D_RECTS;
+		nb = 0;
+		while (i--) {
+			BoxRec full_rect;
 
-		box_init(&full_rect,
-			 prect->x + pDrawable->x,
-			 prect->y + pDrawable->y,
-			 prect->width, prect->height);
+			prefetch (r + 8);
 
-		prect++;
+			box_init(&full_rect,
+				 r->x + pDrawable->x,
+				 r->y + pDrawable->y,
+				 r->width, r->height);
 
-		for (box = RegionRects(clip), nclip = RegionNumRects(clip);
-		     nclip; nclip--, box++) {
-			if (__box_intersect(&boxes[nb], &full_rect, box))
+			r++;
+
+			/* The rest of the clip is done by the hardware */
+			if (__box_intersect(&boxes[nb], &full_rect, op.clip))
 				continue;
 
 			if (++nb >= chunk) {
-				etnaviv_de_op(etnaviv, &op, boxes, nb);
+				etnaviv_de_op_region(etnaviv, &op, clip,
+						     boxes, nb);
 				nb = 0;
 			}
 		}
+		if (nb)
+			etnaviv_de_op_region(etnaviv, &op, clip, boxes, nb);
+		etnaviv_de_end(etnaviv);
 	}
-	if (nb)
-		etnaviv_de_op(etnaviv, &op, boxes, nb);
-	etnaviv_de_end(etnaviv);
 
 	return TRUE;
 }
 
+/* Minimum number of tile repetitions in a box before doubling is used */
+#define TILE_DOUBLING_MIN	16
+
+/*
+ * Fill a box with a large tile by placing a single copy of the tile in
+ * the top left corner, and then doubling the filled area with copies
+ * within the destination, first horizontally and then vertically.
+ * Since each copy is a multiple of the tile size, the tile phase is
+ * preserved.  Each step reads what the previous one wrote, so each
+ * must be a separate operation.
+ */
+static void etnaviv_tile_box_doubling(struct etnaviv *etnaviv,
+	const struct etnaviv_de_op *op, struct etnaviv_de_op *copy,
+	const BoxRec *pBox, xPoint tile_off, int tile_w, int tile_h)
+{
+	int width = pBox->x2 - pBox->x1;
+	int height = pBox->y2 - pBox->y1;
+	xPoint src_origin;
+	BoxRec box;
+	int n, m;
+
+	box_init(&box, pBox->x1, pBox->y1, mint(tile_w, width),
+		 mint(tile_h, height));
+
+	etnaviv_batch_start(etnaviv, op);
+	etnaviv_tile_box(etnaviv, op, &box, tile_off, tile_w, tile_h);
+	etnaviv_de_end(etnaviv);
+
+	src_origin.x = copy->src.offset.x + pBox->x1;
+	src_origin.y = copy->src.offset.y + pBox->y1;
+
+	for (n = tile_w; n < width; n += m) {
+		m = mint(n, width - n);
+		box_init(&box, pBox->x1 + n, pBox->y1, m,
+			 mint(tile_h, height));
+
+		etnaviv_batch_start(etnaviv, copy);
+		etnaviv_de_op_src_origin(etnaviv, copy, src_origin, &box);
+		etnaviv_de_end(etnaviv);
+	}
+
+	for (n = tile_h; n < height; n += m) {
+		m = mint(n, height - n);
+		box_init(&box, pBox->x1, pBox->y1 + n, width, m);
+
+		etnaviv_batch_start(etnaviv, copy);
+		etnaviv_de_op_src_origin(etnaviv, copy, src_origin, &box);
+		etnaviv_de_end(etnaviv);
+	}
+}
+
 Bool etnaviv_accel_PolyFillRectTiled(DrawablePtr pDrawable, GCPtr pGC, int n,
 	xRectangle * prect)
 {
 	struct etnaviv *etnaviv = etnaviv_get_screen_priv(pDrawable->pScreen);
-	struct etnaviv_de_op op;
+	struct etnaviv_de_op op, copy;
 	PixmapPtr pTile = pGC->tile.pixmap;
 	RegionPtr rects;
+	Bool doubling;
 	int nbox;
 
 	if (!etnaviv_init_dst_drawable(etnaviv, &op, pDrawable) ||
@@ -874,6 +1771,21 @@ Bool etnaviv_accel_PolyFillRectTiled(DrawablePtr pDrawable, GCPtr pGC, int n,
 	op.cmd = VIVS_DE_DEST_CONFIG_COMMAND_BIT_BLT;
 	op.brush = FALSE;
 
+	/*
+	 * Doubling reads back from the destination, which is only
+	 * possible with a plain copy.
+	 */
+	doubling = pGC->alu == GXcopy &&
+		   etnaviv_init_dstsrc_drawable(etnaviv, &copy, pDrawable,
+						pDrawable);
+	if (doubling) {
+		copy.blend_op = NULL;
+		copy.src_origin_mode = SRC_ORIGIN_NONE;
+		copy.rop = 0xcc;
+		copy.cmd = VIVS_DE_DEST_CONFIG_COMMAND_BIT_BLT;
+		copy.brush = FALSE;
+	}
+
 	/* Convert the rectangles to a region */
 	rects = RegionFromRects(n, prect, CT_UNSORTED);
 
@@ -885,78 +1797,425 @@ Bool etnaviv_accel_PolyFillRectTiled(DrawablePtr pDrawable, GCPtr pGC, int n,
 
 	nbox = RegionNumRects(rects);
 	if (nbox) {
-		int tile_w, tile_h, tile_off_x, tile_off_y;
+		int tile_w, tile_h;
+		xPoint tile_off;
 		BoxPtr pBox;
 
 		/* Calculate the tile offset from the rect coords */
-		tile_off_x = pDrawable->x + pGC->patOrg.x;
-		tile_off_y = pDrawable->y + pGC->patOrg.y;
+		tile_off.x = pDrawable->x + pGC->patOrg.x;
+		tile_off.y = pDrawable->y + pGC->patOrg.y;
 
 		tile_w = pTile->drawable.width;
 		tile_h = pTile->drawable.height;
 
 		pBox = RegionRects(rects);
 		while (nbox--) {
-			xPoint tile_origin;
-			int dst_y, height, tile_y;
-
 			op.clip = pBox;
 
-			etnaviv_batch_start(etnaviv, &op);
+			/*
+			 * Doubling costs a flush per step, so only use it
+			 * when there are many tile repetitions to draw.
+			 */
+			if (doubling &&
+			    (pBox->x2 - pBox->x1) * (pBox->y2 - pBox->y1) >
+			    TILE_DOUBLING_MIN * tile_w * tile_h) {
+				copy.clip = pBox;
+				etnaviv_tile_box_doubling(etnaviv, &op, &copy,
+							  pBox, tile_off,
+							  tile_w, tile_h);
+			} else {
+				etnaviv_batch_start(etnaviv, &op);
+				etnaviv_tile_box(etnaviv, &op, pBox, tile_off,
+						 tile_w, tile_h);
+				etnaviv_de_end(etnaviv);
+			}
 
-			dst_y = pBox->y1;
-			height = pBox->y2 - dst_y;
-			modulus(dst_y - tile_off_y, tile_h, tile_y);
+			pBox++;
+		}
+	}
 
-			tile_origin.y = tile_y;
+	RegionUninit(rects);
+	RegionDestroy(rects);
 
-			while (height > 0) {
-				int dst_x, width, tile_x, h;
+	return TRUE;
+}
 
-				dst_x = pBox->x1;
-				width = pBox->x2 - dst_x;
-				modulus(dst_x - tile_off_x, tile_w, tile_x);
+/*
+ * Core font glyphs are cached in a monochrome atlas made up of fixed
+ * size cells, and are expanded to the foreground colour by the 2D
+ * engine.  When the atlas fills, it is emptied and refilled.  The
+ * atlas is write-combined: cells are only ever appended while queued
+ * operations may be reading it, so appending needs no synchronisation.
+ */
+#define MONO_CELL_SIZE		32
+#define MONO_ATLAS_COLS		64
+#define MONO_ATLAS_ROWS		64
+#define MONO_ATLAS_CELLS	(MONO_ATLAS_COLS * MONO_ATLAS_ROWS)
+#define MONO_ATLAS_PITCH	(MONO_ATLAS_COLS * MONO_CELL_SIZE / 8)
+#define MONO_ATLAS_SIZE		(MONO_ATLAS_PITCH * MONO_ATLAS_ROWS * \
+				 MONO_CELL_SIZE)
+#define MONO_HASH_SIZE		(2 * MONO_ATLAS_CELLS)
+
+struct etnaviv_mono_glyph {
+	FontPtr font;
+	CharInfoPtr pci;
+	unsigned int cell;
+};
 
-				tile_origin.x = tile_x;
+struct etnaviv_mono_cache {
+	struct etna_bo *bo;
+	uint8_t *ptr;
+	unsigned int nr_cells;
+	/* Set if emptied cells may still be read by queued operations */
+	Bool reused;
+	struct etnaviv_mono_glyph hash[MONO_HASH_SIZE];
+};
 
-				h = tile_h - tile_origin.y;
-				if (h > height)
-					h = height;
-				height -= h;
+static void etnaviv_mono_cache_init(struct etnaviv *etnaviv)
+{
+	struct etnaviv_mono_cache *cache;
 
-				while (width > 0) {
-					BoxRec dst;
-					int w;
+	cache = calloc(1, sizeof(*cache));
+	if (!cache)
+		return;
 
-					w = tile_w - tile_origin.x;
-					if (w > width)
-						w = width;
-					width -= w;
+	cache->bo = etna_bo_new(etnaviv->conn, MONO_ATLAS_SIZE,
+			DRM_ETNA_GEM_TYPE_BMP | DRM_ETNA_GEM_CACHE_WC);
+	if (cache->bo)
+		cache->ptr = etna_bo_map(cache->bo);
 
-					box_init(&dst, dst_x, dst_y, w, h);
-					etnaviv_de_op_src_origin(etnaviv, &op,
-								 tile_origin,
-								 &dst);
+	if (!cache->ptr) {
+		if (cache->bo)
+			etna_bo_del(etnaviv->conn, cache->bo, NULL);
+		free(cache);
+		return;
+	}
 
-					dst_x += w;
-					tile_origin.x = 0;
-				}
-				dst_y += h;
-				tile_origin.y = 0;
-			}
+	etnaviv->mono_cache = cache;
+}
 
-			etnaviv_de_end(etnaviv);
+static void etnaviv_mono_cache_fini(struct etnaviv *etnaviv)
+{
+	struct etnaviv_mono_cache *cache = etnaviv->mono_cache;
 
-			pBox++;
+	if (cache) {
+		etna_bo_del(etnaviv->conn, cache->bo, NULL);
+		free(cache);
+		etnaviv->mono_cache = NULL;
+	}
+}
+
+static void etnaviv_mono_cache_reset(struct etnaviv_mono_cache *cache)
+{
+	memset(cache->hash, 0, sizeof(cache->hash));
+	cache->reused |= cache->nr_cells != 0;
+	cache->nr_cells = 0;
+}
+
+/* Font bitmaps are in the server bit order, the atlas is MSB leftmost */
+static uint8_t etnaviv_mono_byte(uint8_t b)
+{
+#if BITMAP_BIT_ORDER == LSBFirst
+	b = (b & 0xf0) >> 4 | (b & 0x0f) << 4;
+	b = (b & 0xcc) >> 2 | (b & 0x33) << 2;
+	b = (b & 0xaa) >> 1 | (b & 0x55) << 1;
+#endif
+	return b;
+}
+
+static void etnaviv_mono_upload(struct etnaviv_mono_cache *cache,
+	unsigned int cell, CharInfoPtr pci)
+{
+	const uint8_t *src = (const uint8_t *)FONTGLYPHBITS(NULL, pci);
+	unsigned int stride = GLYPHWIDTHBYTESPADDED(pci);
+	unsigned int bytes = (GLYPHWIDTHPIXELS(pci) + 7) / 8;
+	unsigned int height = GLYPHHEIGHTPIXELS(pci);
+	unsigned int i, y;
+	uint8_t *dst;
+
+	dst = cache->ptr +
+	      (cell / MONO_ATLAS_COLS) * MONO_CELL_SIZE * MONO_ATLAS_PITCH +
+	      (cell % MONO_ATLAS_COLS) * MONO_CELL_SIZE / 8;
+
+	for (y = 0; y < height; y++) {
+		for (i = 0; i < bytes; i++)
+			dst[i] = etnaviv_mono_byte(src[i]);
+		src += stride;
+		dst += MONO_ATLAS_PITCH;
+	}
+}
+
+/*
+ * Look up a glyph in the atlas, uploading it if it is not present.
+ * The caller must ensure that there is room for the glyph.
+ */
+static unsigned int etnaviv_mono_lookup(struct etnaviv *etnaviv,
+	FontPtr font, CharInfoPtr pci, Bool *uploaded)
+{
+	struct etnaviv_mono_cache *cache = etnaviv->mono_cache;
+	struct etnaviv_mono_glyph *g;
+	uintptr_t hash;
+
+	hash = (uintptr_t)pci ^ (uintptr_t)font >> 4;
+	hash = (hash >> 3 ^ hash >> 15) & (MONO_HASH_SIZE - 1);
+
+	for (;; hash = (hash + 1) & (MONO_HASH_SIZE - 1)) {
+		g = &cache->hash[hash];
+		if (g->pci == pci && g->font == font)
+			return g->cell;
+		if (!g->pci)
+			break;
+	}
+
+	if (!*uploaded) {
+		/*
+		 * If the atlas has been emptied, previous operations may
+		 * still be reading the cells we are about to overwrite.
+		 */
+		if (cache->reused) {
+			etnaviv_commit(etnaviv, TRUE);
+			cache->reused = FALSE;
 		}
+		*uploaded = TRUE;
 	}
 
-	RegionUninit(rects);
-	RegionDestroy(rects);
+	g->font = font;
+	g->pci = pci;
+	g->cell = cache->nr_cells++;
+
+	etnaviv_mono_upload(cache, g->cell, pci);
+
+	return g->cell;
+}
+
+void etnaviv_accel_UnrealizeFont(struct etnaviv *etnaviv, FontPtr pFont)
+{
+	struct etnaviv_mono_cache *cache = etnaviv->mono_cache;
+	unsigned int i;
+
+	if (!cache)
+		return;
+
+	for (i = 0; i < MONO_HASH_SIZE; i++) {
+		if (cache->hash[i].font == pFont) {
+			etnaviv_mono_cache_reset(cache);
+			break;
+		}
+	}
+}
+
+static Bool etnaviv_accel_glyph_blt(DrawablePtr pDrawable, GCPtr pGC,
+	int x, int y, unsigned int nglyph, CharInfoPtr *ppci, Bool image)
+{
+	struct etnaviv *etnaviv = etnaviv_get_screen_priv(pDrawable->pScreen);
+	struct etnaviv_mono_cache *cache = etnaviv->mono_cache;
+	struct etnaviv_format fmt = { .format = DE_FORMAT_MONOCHROME, };
+	RegionPtr clip = fbGetCompositeClip(pGC);
+	struct etnaviv_de_op op, fill;
+	unsigned int i, n, cell;
+	Bool uploaded = FALSE;
+	BoxRec bg, *boxes;
+	xPoint *origins;
+	int width;
+
+	if (!cache || nglyph > MONO_ATLAS_CELLS)
+		return FALSE;
+
+	if (RegionNumRects(clip) == 0)
+		return TRUE;
+
+	for (i = 0; i < nglyph; i++)
+		if (GLYPHWIDTHPIXELS(ppci[i]) > MONO_CELL_SIZE ||
+		    GLYPHHEIGHTPIXELS(ppci[i]) > MONO_CELL_SIZE)
+			return FALSE;
+
+	if (!etnaviv_init_dst_drawable(etnaviv, &op, pDrawable))
+		return FALSE;
+
+	boxes = malloc(nglyph * (sizeof(*boxes) + sizeof(*origins)));
+	if (!boxes)
+		return FALSE;
+	origins = (xPoint *)(boxes + nglyph);
+
+	if (cache->nr_cells + nglyph > MONO_ATLAS_CELLS)
+		etnaviv_mono_cache_reset(cache);
+
+	x += pDrawable->x;
+	y += pDrawable->y;
+
+	for (i = n = width = 0; i < nglyph; i++) {
+		CharInfoPtr pci = ppci[i];
+		int w = GLYPHWIDTHPIXELS(pci);
+		int h = GLYPHHEIGHTPIXELS(pci);
+
+		if (w && h) {
+			cell = etnaviv_mono_lookup(etnaviv, pGC->font, pci,
+						   &uploaded);
+
+			box_init(&boxes[n], x + width +
+				 pci->metrics.leftSideBearing,
+				 y - pci->metrics.ascent, w, h);
+			origins[n].x = (cell % MONO_ATLAS_COLS) *
+				       MONO_CELL_SIZE;
+			origins[n].y = (cell / MONO_ATLAS_COLS) *
+				       MONO_CELL_SIZE;
+			n++;
+		}
+
+		width += pci->metrics.characterWidth;
+	}
+
+	/* ImageText fills the background using GXcopy */
+	if (image) {
+		box_init(&bg, width < 0 ? x + width : x,
+			 y - FONTASCENT(pGC->font), abs(width),
+			 FONTASCENT(pGC->font) + FONTDESCENT(pGC->font));
+
+		fill = op;
+		fill.src = INIT_BLIT_NULL;
+		fill.blend_op = NULL;
+		fill.clip = RegionExtents(clip);
+		fill.src_origin_mode = SRC_ORIGIN_NONE;
+		fill.rop = 0xf0;
+		fill.cmd = VIVS_DE_DEST_CONFIG_COMMAND_BIT_BLT;
+		fill.brush = TRUE;
+		fill.fg_colour = etnaviv_pixel_col(etnaviv, pGC, pGC->bgPixel);
+		fill.pattern = INIT_BLIT_NULL;
+		fill.stipple = NULL;
+
+		if (!__box_intersect(&bg, &bg, fill.clip)) {
+			etnaviv_batch_start(etnaviv, &fill);
+			etnaviv_de_op_region(etnaviv, &fill, clip, &bg, 1);
+			etnaviv_de_end(etnaviv);
+		}
+	}
+
+	op.src = INIT_BLIT_BO(cache->bo, MONO_ATLAS_PITCH, fmt, ZERO_OFFSET);
+	op.blend_op = NULL;
+	op.src_origin_mode = SRC_ORIGIN_NONE;
+	op.rop = image ? 0xcc : etnaviv_copy_rop[pGC->alu];
+	op.cmd = VIVS_DE_DEST_CONFIG_COMMAND_BIT_BLT;
+	op.brush = FALSE;
+	op.fg_colour = etnaviv_pixel_col(etnaviv, pGC, pGC->fgPixel);
+
+	if (n) {
+		op.clip = RegionExtents(clip);
+		etnaviv_batch_start(etnaviv, &op);
+		etnaviv_de_op_src_origin_clip_rects(etnaviv, &op,
+						    RegionRects(clip),
+						    RegionNumRects(clip),
+						    origins, boxes, n);
+		etnaviv_de_end(etnaviv);
+	}
+
+	free(boxes);
 
 	return TRUE;
 }
 
+Bool etnaviv_accel_ImageGlyphBlt(DrawablePtr pDrawable, GCPtr pGC,
+	int x, int y, unsigned int nglyph, CharInfoPtr *ppci, pointer pglyphBase)
+{
+	return etnaviv_accel_glyph_blt(pDrawable, pGC, x, y, nglyph, ppci,
+				       TRUE);
+}
+
+Bool etnaviv_accel_PolyGlyphBlt(DrawablePtr pDrawable, GCPtr pGC,
+	int x, int y, unsigned int nglyph, CharInfoPtr *ppci, pointer pglyphBase)
+{
+	return etnaviv_accel_glyph_blt(pDrawable, pGC, x, y, nglyph, ppci,
+				       FALSE);
+}
+
+/*
+ * Scratch pixmaps for temporary results.  Rather than going through the
+ * full pixmap creation and destruction for every operation, keep a small
+ * pool of GPU pixmaps, rounded up to power of two size classes so that
+ * they can be recycled for similarly sized operations.
+ */
+static unsigned int etnaviv_scratch_size(unsigned int size)
+{
+	unsigned int class = 64;
+
+	if (size > MAX_SCRATCH_SIZE)
+		return size;
+
+	while (class < size)
+		class <<= 1;
+
+	return class;
+}
+
+PixmapPtr etnaviv_get_scratch(ScreenPtr pScreen, unsigned int width,
+	unsigned int height, unsigned int depth)
+{
+	struct etnaviv *etnaviv = etnaviv_get_screen_priv(pScreen);
+	PixmapPtr pixmap, *found = NULL;
+	unsigned int i;
+
+	width = etnaviv_scratch_size(width);
+	height = etnaviv_scratch_size(height);
+
+	for (i = 0; i < NR_SCRATCH_PIXMAPS; i++) {
+		pixmap = etnaviv->scratch[i];
+		if (!pixmap ||
+		    pixmap->drawable.depth != depth ||
+		    pixmap->drawable.width != width ||
+		    pixmap->drawable.height != height)
+			continue;
+
+		found = &etnaviv->scratch[i];
+
+		/*
+		 * Prefer a pixmap which the GPU has finished with, so
+		 * that any CPU access does not have to wait.
+		 */
+		if (etnaviv_get_pixmap_priv(pixmap)->fence.state == B_NONE)
+			break;
+	}
+
+	if (found) {
+		pixmap = *found;
+		*found = NULL;
+		return pixmap;
+	}
+
+	return pScreen->CreatePixmap(pScreen, width, height, depth,
+				     CREATE_PIXMAP_USAGE_GPU);
+}
+
+void etnaviv_put_scratch(ScreenPtr pScreen, PixmapPtr pixmap)
+{
+	struct etnaviv *etnaviv = etnaviv_get_screen_priv(pScreen);
+	unsigned int i;
+
+	if (pixmap->refcnt == 1 &&
+	    pixmap->drawable.width <= MAX_SCRATCH_SIZE &&
+	    pixmap->drawable.height <= MAX_SCRATCH_SIZE) {
+		for (i = 0; i < NR_SCRATCH_PIXMAPS; i++) {
+			if (!etnaviv->scratch[i]) {
+				etnaviv->scratch[i] = pixmap;
+				return;
+			}
+		}
+	}
+
+	pScreen->DestroyPixmap(pixmap);
+}
+
+void etnaviv_free_scratch(ScreenPtr pScreen)
+{
+	struct etnaviv *etnaviv = etnaviv_get_screen_priv(pScreen);
+	unsigned int i;
+
+	for (i = 0; i < NR_SCRATCH_PIXMAPS; i++) {
+		if (etnaviv->scratch[i]) {
+			pScreen->DestroyPixmap(etnaviv->scratch[i]);
+			etnaviv->scratch[i] = NULL;
+		}
+	}
+}
+
 Bool etnaviv_accel_init(struct etnaviv *etnaviv)
 {
 	Bool pe20;
@@ -996,6 +2255,12 @@ Bool etnaviv_accel_init(struct etnaviv *etnaviv)
 
 	etna_set_pipe(etnaviv->ctx, ETNA_PIPE_2D);
 
+	/* Buffer for loading 8x8 tiles as a pattern brush */
+	etnaviv->pattern_bo = etna_bo_new(etnaviv->conn, 4096,
+					  DRM_ETNA_GEM_TYPE_BMP);
+
+	etnaviv_mono_cache_init(etnaviv);
+
 	/*
 	 * The high watermark is the index in our batch buffer at which
 	 * we dump the queued operation over to the command buffers.
@@ -1046,6 +2311,9 @@ void etnaviv_accel_shutdown(struct etnaviv *etnaviv)
 
 	if (etnaviv->gc320_etna_bo)
 		etna_bo_del(etnaviv->conn, etnaviv->gc320_etna_bo, NULL);
+	if (etnaviv->pattern_bo)
+		etna_bo_del(etnaviv->conn, etnaviv->pattern_bo, NULL);
+	etnaviv_mono_cache_fini(etnaviv);
 
 	etna_free(etnaviv->ctx);
 	viv_close(etnaviv->conn);
@@ -76,6 +76,50 @@ enum {
 /* The size of the additional blit for GC320 */
 #define BATCH_WA_GC320_SIZE	(6 + 6 + 2 + 4 + 4)
 
+/* Tiles of this size can be loaded as a hardware pattern brush */
+#define PATTERN_SIZE		8
+
+/* Scratch pixmap pool: number of pixmaps and the largest size class */
+#define NR_SCRATCH_PIXMAPS	8
+#define MAX_SCRATCH_SIZE	1024
+
+/*
+ * Scratch arena for FillSpans: clipped spans are collected as boxes,
+ * with the indices of the boxes ending on the previous and current
+ * lines tracked so that vertically adjacent spans can be merged.
+ * While a shape is being drawn, spans from the drawable and GC are
+ * collected into a single operation.
+ */
+#define SPAN_ARENA_SIZE		1024
+
+/* Brush colour and ROP for one pass of a planemasked solid fill */
+struct etnaviv_fill_pass {
+	uint32_t colour;
+	uint8_t rop;
+};
+
+struct etnaviv_span_arena {
+	DrawablePtr drawable;
+	GCPtr gc;
+	struct etnaviv_de_op op;
+	struct etnaviv_fill_pass pass[2];
+	unsigned int npass;
+	const BoxRec *band;
+	unsigned short *prev, *cur;
+	unsigned int nbox, nprev, ncur;
+	int line_y;
+	BoxRec box[SPAN_ARENA_SIZE];
+	unsigned short line[2][SPAN_ARENA_SIZE];
+};
+
+struct etnaviv_gc_priv {
+	/* The GC stipple reduced to an 8x8 pattern, if it can be */
+	Bool stipple_valid;
+	uint8_t stipple[8];
+	/* The stipple aligned to the destination of the current op */
+	struct etnaviv_stipple brush;
+};
+
 struct etnaviv {
 	struct viv_conn *conn;
 	struct etna_ctx *ctx;
@@ -87,6 +131,12 @@ struct etnaviv {
 	uint32_t bugs[1];
 	struct etnaviv_de_op gc320_wa;
 	struct etna_bo *gc320_etna_bo;
+	struct etna_bo *pattern_bo;
+	struct etnaviv_mono_cache *mono_cache;
+	struct etnaviv_span_arena span_arena;
+	/* Filter kernel loaded, and the submission it was loaded in */
+	const uint32_t *filter_kernel;
+	unsigned int filter_kernel_seq;
 	int scrnIndex;
 #ifdef HAVE_DRI2
 	Bool dri2_enabled;
@@ -118,6 +168,7 @@ struct etnaviv {
 	CreatePixmapProcPtr CreatePixmap;
 	DestroyPixmapProcPtr DestroyPixmap;
 	CreateGCProcPtr CreateGC;
+	UnrealizeFontProcPtr UnrealizeFont;
 	BitmapToRegionProcPtr BitmapToRegion;
 	ScreenBlockHandlerProcPtr BlockHandler;
 	CreateScreenResourcesProcPtr CreateScreenResources;
@@ -129,6 +180,8 @@ struct etnaviv {
 	AddTrianglesProcPtr AddTriangles;
 	AddTrapsProcPtr AddTraps;
 	UnrealizeGlyphProcPtr UnrealizeGlyph;
+	struct etnaviv_gradient_cache *gradient_cache;
+	PixmapPtr scratch[NR_SCRATCH_PIXMAPS];
 
 	struct etnaviv_xv_priv *xv;
 	unsigned xv_ports;
@@ -206,17 +259,41 @@ Bool etnaviv_accel_PolyLines(DrawablePtr pDrawable, GCPtr pGC, int mode,
 	int npt, DDXPointPtr ppt);
 Bool etnaviv_accel_PolySegment(DrawablePtr pDrawable, GCPtr pGC, int nseg,
 	xSegment *pSeg);
+Bool etnaviv_accel_PolyLinesDash(DrawablePtr pDrawable, GCPtr pGC, int mode,
+	int npt, DDXPointPtr ppt);
+Bool etnaviv_accel_PolySegmentDash(DrawablePtr pDrawable, GCPtr pGC, int nseg,
+	xSegment *pSeg);
+Bool etnaviv_accel_PolySegmentWide(DrawablePtr pDrawable, GCPtr pGC,
+	int nseg, xSegment *pSeg);
 Bool etnaviv_accel_PolyFillRectSolid(DrawablePtr pDrawable, GCPtr pGC, int n,
 	xRectangle * prect);
+Bool etnaviv_GC_tile_is_pattern(GCPtr pGC);
 Bool etnaviv_accel_PolyFillRectTiled(DrawablePtr pDrawable, GCPtr pGC, int n,
 	xRectangle * prect);
+Bool etnaviv_accel_shape_begin(DrawablePtr pDrawable, GCPtr pGC);
+void etnaviv_accel_shape_end(DrawablePtr pDrawable);
+Bool etnaviv_accel_ImageGlyphBlt(DrawablePtr pDrawable, GCPtr pGC,
+	int x, int y, unsigned int nglyph, CharInfoPtr *ppci, pointer pglyphBase);
+Bool etnaviv_accel_PolyGlyphBlt(DrawablePtr pDrawable, GCPtr pGC,
+	int x, int y, unsigned int nglyph, CharInfoPtr *ppci, pointer pglyphBase);
+void etnaviv_accel_UnrealizeFont(struct etnaviv *etnaviv, FontPtr pFont);
 
 void etnaviv_commit(struct etnaviv *etnaviv, Bool stall);
 void etnaviv_finish_fences(struct etnaviv *etnaviv, uint32_t fence);
 
+void etnaviv_batch_wait_fence(struct etnaviv *etnaviv,
+	struct etnaviv_fence *f);
 void etnaviv_batch_wait_commit(struct etnaviv *etnaviv, struct etnaviv_pixmap *vPix);
 void etnaviv_batch_start(struct etnaviv *etnaviv,
 	const struct etnaviv_de_op *op);
+void etnaviv_batch_vr_op(struct etnaviv *etnaviv, struct etnaviv_vr_op *op,
+	const BoxRec *dst, uint32_t x1, uint32_t y1,
+	const BoxRec *boxes, size_t n);
+
+PixmapPtr etnaviv_get_scratch(ScreenPtr pScreen, unsigned int width,
+	unsigned int height, unsigned int depth);
+void etnaviv_put_scratch(ScreenPtr pScreen, PixmapPtr pixmap);
+void etnaviv_free_scratch(ScreenPtr pScreen);
 
 void etnaviv_accel_shutdown(struct etnaviv *);
 Bool etnaviv_accel_init(struct etnaviv *);
@@ -240,6 +317,12 @@ static inline struct etnaviv_pixmap *etnaviv_drawable(DrawablePtr pDrawable)
 	return etnaviv_get_pixmap_priv(pix);
 }
 
+static inline struct etnaviv_gc_priv *etnaviv_get_gc_priv(GCPtr pGC)
+{
+	extern etnaviv_Key etnaviv_gc_index;
+	return etnaviv_GetKeyPrivAddr(&pGC->devPrivates, &etnaviv_gc_index);
+}
+
 static inline struct etnaviv *etnaviv_get_screen_priv(ScreenPtr pScreen)
 {
 	extern etnaviv_Key etnaviv_screen_index;
@@ -9,11 +9,16 @@
 
 #if HAS_DEVPRIVATEKEYREC
 #define etnaviv_CreateKey(key, type) dixRegisterPrivateKey(key, type, 0)
+#define etnaviv_CreateSizedKey(key, type, size) \
+	dixRegisterPrivateKey(key, type, size)
 #define etnaviv_GetKeyPriv(dp, key)  dixGetPrivate(dp, key)
+#define etnaviv_GetKeyPrivAddr(dp, key) dixGetPrivateAddr(dp, key)
 #define etnaviv_Key                  DevPrivateKeyRec
 #else
 #define etnaviv_CreateKey(key, type) dixRequestPrivate(key, 0)
+#define etnaviv_CreateSizedKey(key, type, size) dixRequestPrivate(key, size)
 #define etnaviv_GetKeyPriv(dp, key)  dixLookupPrivate(dp, key)
+#define etnaviv_GetKeyPrivAddr(dp, key) dixLookupPrivate(dp, key)
 #define etnaviv_Key                  int
 #endif
 
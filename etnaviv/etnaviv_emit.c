@@ -24,3 +24,14 @@ void etnaviv_emit(struct etnaviv *etnaviv)
 	memcpy(&ctx->buf[ctx->offset], etnaviv->batch, etnaviv->batch_size * 4);
 	ctx->offset += etnaviv->batch_size;
 }
+
+/*
+ * libetnaviv submits the command buffer whenever it runs out of space
+ * without telling us, so treat every call as a new submission.
+ */
+unsigned int etnaviv_flush_seq(struct etnaviv *etnaviv)
+{
+	static unsigned int seq;
+
+	return ++seq;
+}
@@ -0,0 +1,120 @@
+/*
+ * Etnaviv filter blit kernels
+ *
+ * Written by Russell King, 2012, derived in part from the
+ * Intel xorg X server driver.
+ */
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <math.h>
+
+#include "etnaviv_filter.h"
+
+#include <etnaviv/state_2d.xml.h>
+
+static inline float sinc(float x)
+{
+	return x != 0.0 ? sinf(x) / x : 1.0;
+}
+
+/*
+ * When downscaling by 'scale', the filter is stretched over that many
+ * source pixels to avoid aliasing.  The Lanczos window is narrowed to
+ * match, so that it still fits within the nine filter taps.
+ */
+static float etnaviv_filter_weight(enum etnaviv_filter filter, float x,
+	float scale)
+{
+	float radius;
+
+	x /= scale;
+
+	switch (filter) {
+	case FILTER_BILINEAR:
+		return fabs(x) < 1.0 ? 1.0 - fabs(x) : 0.0;
+
+	case FILTER_LANCZOS:
+	default:
+		radius = 4.0 / scale;
+		if (fabs(x) > radius)
+			return 0.0;
+		return sinc(M_PI * x) * sinc(M_PI * x / radius);
+	}
+}
+
+/*
+ * Some interesting observations of the kernel.  According to the etnaviv
+ * rnndb files:
+ *  - there are 128 states which hold the kernel.
+ *  - each entry contains 9 coefficients (one for each filter tap).
+ *  - the entries are indexed by 5 bits from the fractional coordinate
+ *    (which makes 32 entries.)
+ *
+ * As the kernel table is symmetrical around the centre of the fractional
+ * coordinate, only half of the entries need to be stored.  In other words,
+ * these pairs of indices should be the same:
+ *
+ *  00=31 01=30 02=29 03=28 04=27 05=26 06=25 07=24
+ *  08=23 09=22 10=21 11=20 12=19 13=18 14=17 15=16
+ *
+ * This means that there are only 16 entries.  However, etnaviv
+ * documentation says 17 are required.  What's the additional entry?
+ *
+ * The next issue is that the filter code always produces zero for the
+ * ninth filter tap.  If this is always zero, what's the point of having
+ * hardware deal with nine filter taps?  This makes no sense to me.
+ */
+void etnaviv_init_scaled_filter_kernel(uint32_t *state,
+	enum etnaviv_filter filter, float scale)
+{
+	unsigned row, idx, i;
+	int16_t kernel_val[KERNEL_STATE_SZ * 2];
+	float row_ofs = 0.5;
+
+	/* Compute the filter kernel */
+	for (row = i = 0; row < KERNEL_ROWS; row++) {
+		float kernel[KERNEL_INDICES] = { 0.0 };
+		float sum = 0.0;
+
+		for (idx = 0; idx < KERNEL_INDICES; idx++) {
+			float x = idx - 4.0 + row_ofs;
+
+			kernel[idx] = etnaviv_filter_weight(filter, x, scale);
+			sum += kernel[idx];
+		}
+
+		/* normalise the row */
+		if (sum)
+			for (idx = 0; idx < KERNEL_INDICES; idx++)
+				kernel[idx] /= sum;
+
+		/* convert to 1.14 format */
+		for (idx = 0; idx < KERNEL_INDICES; idx++) {
+			int val = kernel[idx] * (float)(1 << 14);
+
+			if (val < -0x8000)
+				val = -0x8000;
+			else if (val > 0x7fff)
+				val = 0x7fff;
+
+			kernel_val[i++] = val;
+		}
+
+		row_ofs -= 1.0 / ((KERNEL_ROWS - 1) * 2);
+	}
+
+	kernel_val[KERNEL_SIZE] = 0;
+
+	/* Now convert the kernel values into state values */
+	for (i = 0; i < KERNEL_STATE_SZ * 2; i += 2)
+		state[i / 2] =
+			VIVS_DE_FILTER_KERNEL_COEFFICIENT0(kernel_val[i]) |
+			VIVS_DE_FILTER_KERNEL_COEFFICIENT1(kernel_val[i + 1]);
+}
+
+void etnaviv_init_filter_kernel(uint32_t *state, enum etnaviv_filter filter)
+{
+	etnaviv_init_scaled_filter_kernel(state, filter, 1.0);
+}
@@ -0,0 +1,26 @@
+/*
+ * Etnaviv filter blit kernels
+ *
+ * Written by Russell King, 2012, derived in part from the
+ * Intel xorg X server driver.
+ */
+#ifndef ETNAVIV_FILTER_H
+#define ETNAVIV_FILTER_H
+
+#include <stdint.h>
+
+#define KERNEL_ROWS	17
+#define KERNEL_INDICES	9
+#define KERNEL_SIZE	(KERNEL_ROWS * KERNEL_INDICES)
+#define KERNEL_STATE_SZ	((KERNEL_SIZE + 1) / 2)
+
+enum etnaviv_filter {
+	FILTER_LANCZOS,
+	FILTER_BILINEAR,
+};
+
+void etnaviv_init_filter_kernel(uint32_t *state, enum etnaviv_filter filter);
+void etnaviv_init_scaled_filter_kernel(uint32_t *state,
+	enum etnaviv_filter filter, float scale);
+
+#endif
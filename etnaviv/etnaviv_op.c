@@ -4,8 +4,10 @@
 
 #include "xf86.h"
 #include "fb.h"
+#include "utils.h"
 
 #include "etnaviv_accel.h"
+#include "etnaviv_filter.h"
 #include "etnaviv_op.h"
 
 #include <etnaviv/etna.h>
@@ -134,6 +136,26 @@ static void etnaviv_set_source_bo(struct etnaviv *etnaviv,
 	EL_END();
 }
 
+/*
+ * Monochrome sources are expanded using the foreground colour where
+ * the source bit is set.  Clear bits use the background ROP, which
+ * leaves the destination untouched.
+ */
+static void etnaviv_emit_mono_colour(struct etnaviv *etnaviv, uint32_t fg)
+{
+	EL_START(etnaviv, 4);
+	EL(LOADSTATE(VIVS_DE_SRC_COLOR_BG, 2));
+	EL(0);
+	EL(fg);
+	EL_END();
+}
+
+static Bool etnaviv_src_is_mono(const struct etnaviv_de_op *op)
+{
+	return op->src.bo &&
+	       op->src.format.format == DE_FORMAT_MONOCHROME;
+}
+
 static void etnaviv_set_dest_bo(struct etnaviv *etnaviv,
 	const struct etnaviv_blit_buf *buf, uint32_t cmd)
 {
@@ -185,6 +207,58 @@ static void etnaviv_emit_brush(struct etnaviv *etnaviv, uint32_t fg)
 	EL_END();
 }
 
+/*
+ * Load an 8x8 monochrome pattern brush.  Set bits are drawn using the
+ * foreground colour and ROP, clear bits using the background colour
+ * and ROP.
+ */
+static void etnaviv_emit_stipple(struct etnaviv *etnaviv, uint32_t fg,
+	const struct etnaviv_stipple *stipple)
+{
+	const uint8_t *m = stipple->mask;
+
+	EL_START(etnaviv, 8);
+	EL(LOADSTATE(VIVS_DE_PATTERN_MASK_LOW, 4));
+	EL(m[0] | m[1] << 8 | m[2] << 16 | (uint32_t)m[3] << 24);
+	EL(m[4] | m[5] << 8 | m[6] << 16 | (uint32_t)m[7] << 24);
+	EL(stipple->bg_colour);
+	EL(fg);
+	EL_ALIGN();
+	EL(LOADSTATE(VIVS_DE_PATTERN_CONFIG, 1));
+	EL(VIVS_DE_PATTERN_CONFIG_INIT_TRIGGER(3));
+	EL_END();
+}
+
+/*
+ * Load an 8x8 colour pattern brush.  The pattern is stored contiguously,
+ * and is aligned to the destination coordinates.
+ */
+static void etnaviv_emit_pattern(struct etnaviv *etnaviv,
+	const struct etnaviv_blit_buf *pattern)
+{
+	EL_START(etnaviv, 8);
+	EL(LOADSTATE(VIVS_DE_PATTERN_MASK_LOW, 2));
+	EL(~0);
+	EL(~0);
+	EL_ALIGN();
+	EL(LOADSTATE(VIVS_DE_PATTERN_ADDRESS, 2));
+	EL_RELOC(pattern->bo, 0, FALSE);
+	EL(VIVS_DE_PATTERN_CONFIG_FORMAT(pattern->format.format) |
+	   VIVS_DE_PATTERN_CONFIG_TYPE_PATTERN |
+	   VIVS_DE_PATTERN_CONFIG_INIT_TRIGGER(3));
+	EL_END();
+}
+
+static void etnaviv_emit_stretch(struct etnaviv *etnaviv, uint32_t h_scale,
+	uint32_t v_scale)
+{
+	EL_START(etnaviv, 4);
+	EL(LOADSTATE(VIVS_DE_STRETCH_FACTOR_LOW, 2));
+	EL(h_scale);
+	EL(v_scale);
+	EL_END();
+}
+
 static void etnaviv_set_blend(struct etnaviv *etnaviv,
 	const struct etnaviv_blend_op *op)
 {
@@ -260,16 +334,33 @@ static void etnaviv_emit_2d_draw(struct etnaviv *etnaviv, const BoxRec *pbox,
 	EL_END();
 }
 
+static uint8_t etnaviv_bg_rop(const struct etnaviv_de_op *op)
+{
+	if (op->brush && op->stipple)
+		return op->stipple->bg_rop;
+	if (etnaviv_src_is_mono(op))
+		return 0xaa;
+	return op->rop;
+}
+
 static void de_start(struct etnaviv *etnaviv, const struct etnaviv_de_op *op)
 {
 	if (op->src.bo)
 		etnaviv_set_source_bo(etnaviv, &op->src, op->src_origin_mode);
+	if (etnaviv_src_is_mono(op))
+		etnaviv_emit_mono_colour(etnaviv, op->fg_colour);
 	etnaviv_set_dest_bo(etnaviv, &op->dst, op->cmd);
+	if (op->cmd == VIVS_DE_DEST_CONFIG_COMMAND_STRETCH_BLT)
+		etnaviv_emit_stretch(etnaviv, op->h_scale, op->v_scale);
 	etnaviv_set_blend(etnaviv, op->blend_op);
-	if (op->brush)
+	if (op->brush && op->pattern.bo)
+		etnaviv_emit_pattern(etnaviv, &op->pattern);
+	else if (op->brush && op->stipple)
+		etnaviv_emit_stipple(etnaviv, op->fg_colour, op->stipple);
+	else if (op->brush)
 		etnaviv_emit_brush(etnaviv, op->fg_colour);
-	etnaviv_emit_rop_clip(etnaviv, op->rop, op->rop, op->clip,
-			      op->dst.offset);
+	etnaviv_emit_rop_clip(etnaviv, op->rop, etnaviv_bg_rop(op),
+			      op->clip, op->dst.offset);
 	etnaviv_emit_src_rotate(etnaviv, &op->src);
 }
 
@@ -409,6 +500,127 @@ void etnaviv_de_op(struct etnaviv *etnaviv, const struct etnaviv_de_op *op,
 	}
 }
 
+/*
+ * Draw the boxes once for each clip rectangle, using the hardware clip
+ * rather than intersecting each box with each rectangle in software.
+ * Clip rectangles which do not overlap the boxes are skipped.  The
+ * hardware clip is left set to the last clip rectangle drawn.
+ */
+void etnaviv_de_op_clip_rects(struct etnaviv *etnaviv,
+	const struct etnaviv_de_op *op, const BoxRec *clip, size_t nclip,
+	const BoxRec *pBox, size_t nBox)
+{
+	unsigned int high_wm = etnaviv->batch_de_high_watermark;
+	unsigned int max_rects = VIVANTE_MAX_2D_RECTS;
+	uint8_t bg_rop = etnaviv_bg_rop(op);
+	BoxRec extents;
+	size_t i;
+
+	assert(nBox);
+
+	if (op->cmd == VIVS_DE_DEST_CONFIG_COMMAND_BIT_BLT &&
+	    etnaviv_has_bugfix(etnaviv, BUGFIX_SINGLE_BITBLT_DRAW_OP))
+		max_rects = 1;
+
+	extents = pBox[0];
+	for (i = 1; i < nBox; i++) {
+		extents.x1 = min_t(short, extents.x1, pBox[i].x1);
+		extents.y1 = min_t(short, extents.y1, pBox[i].y1);
+		extents.x2 = max_t(short, extents.x2, pBox[i].x2);
+		extents.y2 = max_t(short, extents.y2, pBox[i].y2);
+	}
+
+	for (; nclip; nclip--, clip++) {
+		const BoxRec *b = pBox;
+		size_t nb = nBox;
+		Bool set_clip = TRUE;
+
+		if (clip->x1 >= extents.x2 || clip->x2 <= extents.x1 ||
+		    clip->y1 >= extents.y2 || clip->y2 <= extents.y1)
+			continue;
+
+		do {
+			unsigned int remaining = high_wm - etnaviv->batch_size;
+			unsigned int n;
+
+			if (remaining <= 4 + 8) {
+				etnaviv_de_end(etnaviv);
+				BATCH_OP_START(etnaviv);
+				set_clip = TRUE;
+				continue;
+			}
+
+			/* Splitting the batch restores the original clip */
+			if (set_clip) {
+				etnaviv_emit_rop_clip(etnaviv, op->rop, bg_rop,
+						      clip, op->dst.offset);
+				remaining -= 4;
+				set_clip = FALSE;
+			}
+
+			n = (remaining - 8) / 2;
+			if (n > max_rects)
+				n = max_rects;
+			if (n > nb)
+				n = nb;
+
+			etnaviv_emit_2d_draw(etnaviv, b, n, op->dst.offset);
+
+			b += n;
+			nb -= n;
+
+			EL_START(etnaviv, 6);
+			EL(LOADSTATE(4, 1));
+			EL(0);
+			EL(LOADSTATE(4, 1));
+			EL(0);
+			EL(LOADSTATE(4, 1));
+			EL(0);
+			EL_END();
+		} while (nb);
+	}
+}
+
+/*
+ * As etnaviv_de_op_clip_rects(), but each box is drawn from its own
+ * source origin, as for glyphs drawn from an atlas.
+ */
+void etnaviv_de_op_src_origin_clip_rects(struct etnaviv *etnaviv,
+	const struct etnaviv_de_op *op, const BoxRec *clip, size_t nclip,
+	const xPoint *src_origin, const BoxRec *pBox, size_t nBox)
+{
+	unsigned int high_wm = etnaviv->batch_de_high_watermark;
+	size_t op_size = etnaviv_size_2d_draw(etnaviv, 1) + 6 + 2;
+	uint8_t bg_rop = etnaviv_bg_rop(op);
+	size_t i;
+
+	for (; nclip; nclip--, clip++) {
+		Bool set_clip = TRUE;
+
+		for (i = 0; i < nBox; i++) {
+			if (pBox[i].x1 >= clip->x2 || pBox[i].x2 <= clip->x1 ||
+			    pBox[i].y1 >= clip->y2 || pBox[i].y2 <= clip->y1)
+				continue;
+
+			/* Splitting the batch restores the original clip */
+			if (op_size + 4 > high_wm - etnaviv->batch_size) {
+				etnaviv_de_end(etnaviv);
+				BATCH_OP_START(etnaviv);
+				set_clip = TRUE;
+			}
+
+			if (set_clip) {
+				etnaviv_emit_rop_clip(etnaviv, op->rop, bg_rop,
+						      clip, op->dst.offset);
+				set_clip = FALSE;
+			}
+
+			etnaviv_de_op_src_origin(etnaviv, op, src_origin[i],
+						 &pBox[i]);
+		}
+	}
+}
+
 void etnaviv_vr_op(struct etnaviv *etnaviv, struct etnaviv_vr_op *op,
 	const BoxRec *dst, uint32_t x1, uint32_t y1,
 	const BoxRec *boxes, size_t n)
@@ -499,6 +711,25 @@ void etnaviv_vr_op(struct etnaviv *etnaviv, struct etnaviv_vr_op *op,
 	etnaviv_emit(etnaviv);
 }
 
+/*
+ * Load the filter blit kernel, unless it is already loaded.  The GPU
+ * state does not survive between submissions, which may happen behind
+ * our back when the command buffer fills.
+ */
+void etnaviv_set_filter_kernel(struct etnaviv *etnaviv, const uint32_t *kernel)
+{
+	if (etnaviv->filter_kernel == kernel &&
+	    etnaviv->filter_kernel_seq == etnaviv_flush_seq(etnaviv))
+		return;
+
+	etna_set_state_multi(etnaviv->ctx, VIVS_DE_FILTER_KERNEL(0),
+			     KERNEL_STATE_SZ, kernel);
+
+	/* Loading the kernel may itself have submitted the buffer */
+	etnaviv->filter_kernel = kernel;
+	etnaviv->filter_kernel_seq = etnaviv_flush_seq(etnaviv);
+}
+
 void etnaviv_flush(struct etnaviv *etnaviv)
 {
 	struct etna_ctx *ctx = etnaviv->ctx;
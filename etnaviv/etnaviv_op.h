@@ -34,6 +34,13 @@ struct etnaviv_blend_op {
 	uint8_t dst_alpha;
 };
 
+/* An 8x8 monochrome pattern, one byte per row, MSB leftmost */
+struct etnaviv_stipple {
+	uint8_t mask[8];
+	uint32_t bg_colour;
+	uint8_t bg_rop;
+};
+
 struct etnaviv_blit_buf {
 	struct etnaviv_format format;
 	struct etnaviv_pixmap *pixmap;
@@ -84,7 +91,11 @@ struct etnaviv_de_op {
 	uint8_t rop;
 	unsigned cmd;
 	Bool brush;
-	uint32_t fg_colour;
+	uint32_t fg_colour;	/* brush, or mono source foreground */
+	struct etnaviv_blit_buf pattern;	/* brush only: colour pattern */
+	const struct etnaviv_stipple *stipple;	/* brush only: mono pattern */
+	uint32_t h_scale;	/* STRETCH_BLT only */
+	uint32_t v_scale;	/* STRETCH_BLT only */
 };
 
 struct etnaviv_vr_op {
@@ -105,10 +116,18 @@ void etnaviv_de_op_src_origin(struct etnaviv *etnaviv,
 	const struct etnaviv_de_op *op, xPoint src_origin, const BoxRec *dest);
 void etnaviv_de_op(struct etnaviv *etnaviv, const struct etnaviv_de_op *op,
 	const BoxRec *pBox, size_t nBox);
+void etnaviv_de_op_clip_rects(struct etnaviv *etnaviv,
+	const struct etnaviv_de_op *op, const BoxRec *clip, size_t nclip,
+	const BoxRec *pBox, size_t nBox);
+void etnaviv_de_op_src_origin_clip_rects(struct etnaviv *etnaviv,
+	const struct etnaviv_de_op *op, const BoxRec *clip, size_t nclip,
+	const xPoint *src_origin, const BoxRec *pBox, size_t nBox);
 void etnaviv_vr_op(struct etnaviv *etnaviv, struct etnaviv_vr_op *op,
 	const BoxRec *dst, uint32_t x1, uint32_t y1,
 	const BoxRec *boxes, size_t n);
+void etnaviv_set_filter_kernel(struct etnaviv *etnaviv, const uint32_t *kernel);
 void etnaviv_emit(struct etnaviv *etnaviv);
+unsigned int etnaviv_flush_seq(struct etnaviv *etnaviv);
 void etnaviv_flush(struct etnaviv *etnaviv);
 
 #endif
@@ -27,6 +27,7 @@
 #include "fbpict.h"
 
 #include "boxutil.h"
+#include "cpu_access.h"
 #include "glyph_assemble.h"
 #include "glyph_cache.h"
 #include "glyph_extents.h"
@@ -35,9 +36,11 @@
 #include "unaccel.h"
 
 #include "etnaviv_accel.h"
+#include "etnaviv_filter.h"
 #include "etnaviv_render.h"
 #include "etnaviv_utils.h"
 
+#include <etnaviv/etna.h>
 #include <etnaviv/etna_bo.h>
 #include <etnaviv/common.xml.h>
 #include <etnaviv/state_2d.xml.h>
@@ -175,6 +178,21 @@ static Bool picture_transform(PicturePtr pict, struct transform_properties *p)
 	return FALSE;
 }
 
+/*
+ * A pure scale (with any translation) can be performed by the VR filter
+ * blit engine.  Reflections are not supported.
+ */
+static Bool picture_is_scaled(PictTransformPtr t)
+{
+	return t->matrix[2][0] == 0 &&
+	       t->matrix[2][1] == 0 &&
+	       t->matrix[2][2] == pixman_int_to_fixed(1) &&
+	       t->matrix[0][1] == 0 &&
+	       t->matrix[1][0] == 0 &&
+	       t->matrix[0][0] > 0 &&
+	       t->matrix[1][1] > 0;
+}
+
 static Bool picture_has_pixels(PicturePtr pPict, xPoint origin,
 	const BoxRec *box)
 {
@@ -238,12 +256,13 @@ static Bool etnaviv_blend_src_alpha_normal(struct etnaviv_blend_op *op)
 		VIVS_DE_ALPHA_MODES_GLOBAL_SRC_ALPHA_MODE_NORMAL;
 }
 
-static Bool etnaviv_fill_single(struct etnaviv *etnaviv,
-	struct etnaviv_pixmap *vPix, const BoxRec *clip, uint32_t colour)
+static Bool etnaviv_fill_rop(struct etnaviv *etnaviv,
+	struct etnaviv_pixmap *vPix, const BoxRec *clip, uint32_t colour,
+	uint8_t rop)
 {
 	struct etnaviv_de_op op = {
 		.clip = clip,
-		.rop = 0xf0,
+		.rop = rop,
 		.cmd = VIVS_DE_DEST_CONFIG_COMMAND_BIT_BLT,
 		.brush = TRUE,
 		.fg_colour = colour,
@@ -261,6 +280,12 @@ static Bool etnaviv_fill_single(struct etnaviv *etnaviv,
 	return TRUE;
 }
 
+static Bool etnaviv_fill_single(struct etnaviv *etnaviv,
+	struct etnaviv_pixmap *vPix, const BoxRec *clip, uint32_t colour)
+{
+	return etnaviv_fill_rop(etnaviv, vPix, clip, colour, 0xf0);
+}
+
 static Bool etnaviv_blend(struct etnaviv *etnaviv, const BoxRec *clip,
 	const struct etnaviv_blend_op *blend,
 	struct etnaviv_pixmap *vDst, struct etnaviv_pixmap *vSrc,
@@ -306,8 +331,7 @@ static struct etnaviv_pixmap *etnaviv_get_scratch_argb(ScreenPtr pScreen,
 	if (*ppPixmap)
 		return etnaviv_get_pixmap_priv(*ppPixmap);
 
-	pixmap = pScreen->CreatePixmap(pScreen, width, height, 32,
-				       CREATE_PIXMAP_USAGE_GPU);
+	pixmap = etnaviv_get_scratch(pScreen, width, height, 32);
 	if (!pixmap)
 		return NULL;
 
@@ -516,6 +540,478 @@ static struct etnaviv_pixmap *etnaviv_acquire_drawable_picture(
 	return vpix;
 }
 
+static uint32_t etnaviv_bilinear_kernel[KERNEL_STATE_SZ];
+static uint32_t etnaviv_lanczos_kernel[KERNEL_STATE_SZ];
+
+/*
+ * Acquire a scaled drawable picture into the temporary pixmap using
+ * the VR filter blit engine: a vertical filter blit of the needed
+ * source columns into a stage pixmap, followed by a horizontal filter
+ * blit into the temporary.  Returns NULL if this is not possible.
+ */
+static struct etnaviv_pixmap *etnaviv_acquire_scaled(ScreenPtr pScreen,
+	PicturePtr pict, const BoxRec *clip, PixmapPtr *ppPixTemp,
+	xPoint *src_topleft)
+{
+	struct etnaviv *etnaviv = etnaviv_get_screen_priv(pScreen);
+	PictTransformPtr t = pict->transform;
+	DrawablePtr drawable = pict->pDrawable;
+	struct etnaviv_pixmap *vSrc, *vStage, *vTemp;
+	PixmapPtr pPixStage = NULL;
+	struct etnaviv_vr_op op;
+	struct pixman_vector vec;
+	const uint32_t *kernel;
+	BoxRec bounds, stage;
+	xPoint offset;
+	int64_t x2;
+	int32_t x, y;
+	int sx1, sx2;
+
+	if (!drawable || !t || !picture_is_scaled(t))
+		return NULL;
+
+	switch (pict->filter) {
+	case PictFilterBilinear:
+	case PictFilterGood:
+		kernel = etnaviv_bilinear_kernel;
+		break;
+	case PictFilterBest:
+		kernel = etnaviv_lanczos_kernel;
+		break;
+	default:
+		return NULL;
+	}
+
+	if (!picture_has_pixels(pict, *src_topleft, clip))
+		return NULL;
+
+	vSrc = etnaviv_drawable_offset(drawable, &offset);
+	if (!vSrc)
+		return NULL;
+
+	offset.x += drawable->x;
+	offset.y += drawable->y;
+
+	etnaviv_set_format(vSrc, pict);
+	if (!etnaviv_src_format_valid(etnaviv, vSrc->pict_format))
+		return NULL;
+
+	/* The 16.16 source position of the top left of the clip box */
+	vec.vector[0] = pixman_int_to_fixed(src_topleft->x + clip->x1);
+	vec.vector[1] = pixman_int_to_fixed(src_topleft->y + clip->y1);
+	vec.vector[2] = pixman_int_to_fixed(1);
+	if (!pixman_transform_point(t, &vec))
+		return NULL;
+
+	x = vec.vector[0] + pixman_int_to_fixed(offset.x);
+	y = vec.vector[1] + pixman_int_to_fixed(offset.y);
+	if (x < 0 || y < 0)
+		return NULL;
+
+	/* The source drawable on its pixmap */
+	box_init(&bounds, offset.x, offset.y,
+		 drawable->width, drawable->height);
+
+	/*
+	 * The source columns sampled by the horizontal pass, including
+	 * the filter taps either side.
+	 */
+	x2 = x + (int64_t)t->matrix[0][0] * box_width(clip);
+	sx1 = max_t(int, pixman_fixed_to_int(x) - KERNEL_INDICES / 2,
+		    bounds.x1);
+	sx2 = min_t(int, (x2 >> 16) + KERNEL_INDICES / 2 + 1, bounds.x2);
+	if (sx1 >= sx2)
+		return NULL;
+
+	box_init(&stage, 0, 0, sx2 - sx1, box_height(clip));
+
+	vStage = etnaviv_get_scratch_argb(pScreen, &pPixStage,
+					  stage.x2, stage.y2);
+	vTemp = etnaviv_get_scratch_argb(pScreen, ppPixTemp,
+					 clip->x2, clip->y2);
+	if (!vStage || !vTemp ||
+	    !etnaviv_map_gpu(etnaviv, vSrc, GPU_ACCESS_RO) ||
+	    !etnaviv_map_gpu(etnaviv, vStage, GPU_ACCESS_RW) ||
+	    !etnaviv_map_gpu(etnaviv, vTemp, GPU_ACCESS_RW)) {
+		vTemp = NULL;
+		goto out;
+	}
+
+	etnaviv_set_filter_kernel(etnaviv, kernel);
+
+	/* Vertical filter blit of the source columns into the stage */
+	op.src = INIT_BLIT_PIX(vSrc, vSrc->pict_format, ZERO_OFFSET);
+	op.src_pitches = op.src_offsets = NULL;
+	op.src_bounds = bounds;
+	op.dst = INIT_BLIT_PIX(vStage, vStage->pict_format, ZERO_OFFSET);
+	op.h_scale = 1 << 16;
+	op.v_scale = t->matrix[1][1];
+	op.cmd = VIVS_DE_DEST_CONFIG_COMMAND_VER_FILTER_BLT;
+	op.vr_op = VIVS_DE_VR_CONFIG_START_VERTICAL_BLIT;
+
+	etnaviv_batch_vr_op(etnaviv, &op, &stage, pixman_int_to_fixed(sx1),
+			    y, &stage, 1);
+
+	/* Horizontal filter blit of the stage into the temporary */
+	op.src = INIT_BLIT_PIX(vStage, vStage->pict_format, ZERO_OFFSET);
+	op.src_bounds = stage;
+	op.dst = INIT_BLIT_PIX(vTemp, vTemp->pict_format, ZERO_OFFSET);
+	op.h_scale = t->matrix[0][0];
+	op.v_scale = 1 << 16;
+	op.cmd = VIVS_DE_DEST_CONFIG_COMMAND_HOR_FILTER_BLT;
+	op.vr_op = VIVS_DE_VR_CONFIG_START_HORIZONTAL_BLIT;
+
+	etnaviv_batch_vr_op(etnaviv, &op, clip, x - pixman_int_to_fixed(sx1),
+			    0, clip, 1);
+	etnaviv_flush(etnaviv);
+
+	/* A source without alpha must end up with an alpha of 1.0 */
+	if (!PICT_FORMAT_A(pict->format) &&
+	    !etnaviv_fill_rop(etnaviv, vTemp, clip, 0xff000000, 0xfa)) {
+		vTemp = NULL;
+		goto out;
+	}
+
+	src_topleft->x = 0;
+	src_topleft->y = 0;
+
+out:
+	if (pPixStage)
+		etnaviv_put_scratch(pScreen, pPixStage);
+
+	return vTemp;
+}
+
+/*
+ * Gradient source pictures are immutable, but applications (and theme
+ * engines in particular) tend to recreate identical gradients for every
+ * frame.  Cache the rendered gradients in GPU pixmaps, keyed by the
+ * gradient parameters and the area rendered.  Horizontal and vertical
+ * linear gradients are cached as a single row or column, which is then
+ * expanded when it is used.
+ */
+#define NR_GRADIENTS		16
+#define GRADIENT_MAX_AREA	(512 * 512)
+
+enum {
+	GRADIENT_FULL,
+	GRADIENT_HORIZONTAL,	/* varies with x only: cached as 1 row */
+	GRADIENT_VERTICAL,	/* varies with y only: cached as 1 column */
+};
+
+struct etnaviv_gradient_key {
+	unsigned int type;
+	unsigned int repeat;
+	int nstops;
+	union {
+		struct {
+			xPointFixed p1, p2;
+		} linear;
+		struct {
+			PictCircle c1, c2;
+		} radial;
+		struct {
+			xPointFixed center;
+			xFixed angle;
+		} conical;
+	} u;
+	Bool has_transform;
+	PictTransform transform;
+};
+
+struct etnaviv_gradient {
+	struct etnaviv_gradient_key key;
+	PictGradientStopPtr stops;
+	unsigned int strip;
+	BoxRec box;
+	PixmapPtr pixmap;
+	unsigned long last_use;
+};
+
+struct etnaviv_gradient_cache {
+	struct etnaviv_gradient entry[NR_GRADIENTS];
+	unsigned long time;
+};
+
+static Bool etnaviv_pict_is_gradient(PicturePtr pict)
+{
+	SourcePictPtr sp = pict->pSourcePict;
+
+	return sp && (sp->type == SourcePictTypeLinear ||
+		      sp->type == SourcePictTypeRadial ||
+		      sp->type == SourcePictTypeConical);
+}
+
+static void etnaviv_gradient_key(PicturePtr pict,
+	struct etnaviv_gradient_key *key)
+{
+	SourcePictPtr sp = pict->pSourcePict;
+
+	/* Clear any padding, as keys are compared with memcmp() */
+	memset(key, 0, sizeof(*key));
+
+	switch (sp->type) {
+	case SourcePictTypeLinear:
+		key->u.linear.p1 = sp->linear.p1;
+		key->u.linear.p2 = sp->linear.p2;
+		break;
+	case SourcePictTypeRadial:
+		key->u.radial.c1 = sp->radial.c1;
+		key->u.radial.c2 = sp->radial.c2;
+		break;
+	case SourcePictTypeConical:
+		key->u.conical.center = sp->conical.center;
+		key->u.conical.angle = sp->conical.angle;
+		break;
+	}
+
+	key->type = sp->type;
+	key->nstops = sp->gradient.nstops;
+	key->repeat = pict->repeat ? pict->repeatType : RepeatNone;
+	if (pict->transform) {
+		key->has_transform = TRUE;
+		key->transform = *pict->transform;
+	}
+}
+
+static unsigned int etnaviv_gradient_strip(PicturePtr pict)
+{
+	SourcePictPtr sp = pict->pSourcePict;
+
+	if (sp->type != SourcePictTypeLinear || pict->transform)
+		return GRADIENT_FULL;
+	if (sp->linear.p1.y == sp->linear.p2.y)
+		return GRADIENT_HORIZONTAL;
+	if (sp->linear.p1.x == sp->linear.p2.x)
+		return GRADIENT_VERTICAL;
+	return GRADIENT_FULL;
+}
+
+static void etnaviv_gradient_free(ScreenPtr pScreen,
+	struct etnaviv_gradient *g)
+{
+	if (g->pixmap)
+		etnaviv_put_scratch(pScreen, g->pixmap);
+	free(g->stops);
+	g->pixmap = NULL;
+	g->stops = NULL;
+}
+
+static struct etnaviv_gradient *etnaviv_gradient_lookup(
+	struct etnaviv_gradient_cache *cache, PicturePtr pict,
+	const struct etnaviv_gradient_key *key, unsigned int strip,
+	const BoxRec *box)
+{
+	size_t stops_size = key->nstops * sizeof(PictGradientStop);
+	struct etnaviv_gradient *g;
+	BoxRec b;
+
+	for (g = cache->entry; g < cache->entry + NR_GRADIENTS; g++) {
+		if (!g->pixmap || g->strip != strip ||
+		    memcmp(&g->key, key, sizeof(*key)) ||
+		    memcmp(g->stops, pict->pSourcePict->gradient.stops,
+			   stops_size))
+			continue;
+
+		/* The cached area must contain the requested area */
+		if (__box_intersect(&b, &g->box, box) ||
+		    memcmp(&b, box, sizeof(b)))
+			continue;
+
+		g->last_use = ++cache->time;
+		return g;
+	}
+
+	return NULL;
+}
+
+static struct etnaviv_gradient *etnaviv_gradient_create(ScreenPtr pScreen,
+	struct etnaviv_gradient_cache *cache, PicturePtr pict,
+	const struct etnaviv_gradient_key *key, unsigned int strip,
+	const BoxRec *box)
+{
+	size_t stops_size = key->nstops * sizeof(PictGradientStop);
+	struct etnaviv_gradient *g, *lru;
+	struct etnaviv_pixmap *vPix;
+
+	/* Replace an unused entry, or the least recently used entry */
+	for (g = lru = cache->entry; g < cache->entry + NR_GRADIENTS; g++) {
+		if (!g->pixmap) {
+			lru = g;
+			break;
+		}
+		if (g->last_use < lru->last_use)
+			lru = g;
+	}
+	g = lru;
+
+	etnaviv_gradient_free(pScreen, g);
+
+	g->stops = malloc(stops_size);
+	if (stops_size && !g->stops)
+		return NULL;
+
+	vPix = etnaviv_get_scratch_argb(pScreen, &g->pixmap,
+					box_width(box), box_height(box));
+	if (!vPix)
+		goto fail;
+
+	if (!etnaviv_composite_to_pixmap(PictOpSrc, pict, NULL, g->pixmap,
+					 box->x1, box->y1, 0, 0,
+					 box_width(box), box_height(box)))
+		goto fail;
+
+	memcpy(g->stops, pict->pSourcePict->gradient.stops, stops_size);
+	g->key = *key;
+	g->strip = strip;
+	g->box = *box;
+	g->last_use = ++cache->time;
+
+	return g;
+
+fail:
+	etnaviv_gradient_free(pScreen, g);
+	return NULL;
+}
+
+/*
+ * Expand a gradient row or column into the clip area of the temporary
+ * pixmap, by copying it to the first row or column, and then doubling
+ * up the copied area until the clip is filled.
+ */
+static Bool etnaviv_gradient_expand(struct etnaviv *etnaviv,
+	struct etnaviv_pixmap *vTemp, struct etnaviv_pixmap *vStrip,
+	const BoxRec *clip, xPoint offset, unsigned int strip)
+{
+	xPoint step = ZERO_OFFSET;
+	BoxRec box = *clip;
+	int n, m, size;
+
+	if (strip == GRADIENT_HORIZONTAL) {
+		box.y2 = box.y1 + 1;
+		offset.y = -clip->y1;
+		size = box_height(clip);
+	} else {
+		box.x2 = box.x1 + 1;
+		offset.x = -clip->x1;
+		size = box_width(clip);
+	}
+
+	if (!etnaviv_blend(etnaviv, &box, NULL, vTemp, vStrip, &box, 1,
+			   offset, ZERO_OFFSET))
+		return FALSE;
+
+	for (n = 1; n < size; n += m) {
+		m = mint(n, size - n);
+		box = *clip;
+		if (strip == GRADIENT_HORIZONTAL) {
+			box.y1 += n;
+			box.y2 = box.y1 + m;
+			step.y = -n;
+		} else {
+			box.x1 += n;
+			box.x2 = box.x1 + m;
+			step.x = -n;
+		}
+
+		if (!etnaviv_blend(etnaviv, &box, NULL, vTemp, vTemp, &box, 1,
+				   step, ZERO_OFFSET))
+			return FALSE;
+	}
+
+	return TRUE;
+}
+
+/*
+ * Acquire a gradient picture from the gradient cache.  Returns NULL if
+ * this is not possible.
+ */
+static struct etnaviv_pixmap *etnaviv_acquire_gradient(ScreenPtr pScreen,
+	PicturePtr pict, const BoxRec *clip, PixmapPtr *ppPixTemp,
+	xPoint *src_topleft, Bool force_vtemp)
+{
+	struct etnaviv *etnaviv = etnaviv_get_screen_priv(pScreen);
+	struct etnaviv_gradient_cache *cache = etnaviv->gradient_cache;
+	struct etnaviv_gradient_key key;
+	struct etnaviv_pixmap *vGrad, *vTemp;
+	struct etnaviv_gradient *g;
+	unsigned int strip;
+	xPoint offset;
+	BoxRec box;
+
+	if (!cache || !etnaviv_pict_is_gradient(pict))
+		return NULL;
+
+	/* The area of the gradient which is required */
+	box.x1 = src_topleft->x + clip->x1;
+	box.y1 = src_topleft->y + clip->y1;
+	box.x2 = src_topleft->x + clip->x2;
+	box.y2 = src_topleft->y + clip->y2;
+
+	strip = etnaviv_gradient_strip(pict);
+	if (strip == GRADIENT_HORIZONTAL) {
+		box.y1 = 0;
+		box.y2 = 1;
+	} else if (strip == GRADIENT_VERTICAL) {
+		box.x1 = 0;
+		box.x2 = 1;
+	}
+
+	if (box_area(&box) > GRADIENT_MAX_AREA)
+		return NULL;
+
+	etnaviv_gradient_key(pict, &key);
+
+	g = etnaviv_gradient_lookup(cache, pict, &key, strip, &box);
+	if (!g) {
+		g = etnaviv_gradient_create(pScreen, cache, pict, &key,
+					    strip, &box);
+		if (!g)
+			return NULL;
+	}
+
+	vGrad = etnaviv_get_pixmap_priv(g->pixmap);
+
+	/* Offset from temporary coordinates to the gradient pixmap */
+	offset.x = src_topleft->x - g->box.x1;
+	offset.y = src_topleft->y - g->box.y1;
+
+	if (strip == GRADIENT_FULL && !force_vtemp) {
+		*src_topleft = offset;
+		return vGrad;
+	}
+
+	vTemp = etnaviv_get_scratch_argb(pScreen, ppPixTemp,
+					 clip->x2, clip->y2);
+	if (!vTemp)
+		return NULL;
+
+	if (strip == GRADIENT_FULL) {
+		if (!etnaviv_blend(etnaviv, clip, NULL, vTemp, vGrad, clip, 1,
+				   offset, ZERO_OFFSET))
+			return NULL;
+	} else if (!etnaviv_gradient_expand(etnaviv, vTemp, vGrad, clip,
+					    offset, strip)) {
+		return NULL;
+	}
+
+	src_topleft->x = 0;
+	src_topleft->y = 0;
+
+	return vTemp;
+}
+
+static void etnaviv_gradient_cache_fini(ScreenPtr pScreen,
+	struct etnaviv_gradient_cache *cache)
+{
+	unsigned int i;
+
+	for (i = 0; i < NR_GRADIENTS; i++)
+		etnaviv_gradient_free(pScreen, &cache->entry[i]);
+
+	free(cache);
+}
+
 /*
  * Acquire the source. If we're filling a solid surface, force it to have
  * alpha; it may be used in combination with a mask.  Otherwise, we ask
@@ -550,10 +1046,33 @@ static struct etnaviv_pixmap *etnaviv_acquire_src(ScreenPtr pScreen,
 		return vTemp;
 	}
 
+	if (!pict->pDrawable) {
+		vTemp = etnaviv_acquire_gradient(pScreen, pict, clip,
+						 ppPixTemp, src_topleft,
+						 force_vtemp);
+		if (!vTemp)
+			goto fallback;
+
+		if (rotation)
+			*rotation = DE_ROT_MODE_ROT0;
+
+		return vTemp;
+	}
+
 	vSrc = etnaviv_acquire_drawable_picture(pScreen, pict, clip,
 						src_topleft, rotation);
-	if (!vSrc)
-		goto fallback;
+	if (!vSrc) {
+		/* Scaled sources may be possible with the VR filter blit */
+		vTemp = etnaviv_acquire_scaled(pScreen, pict, clip, ppPixTemp,
+					       src_topleft);
+		if (!vTemp)
+			goto fallback;
+
+		if (rotation)
+			*rotation = DE_ROT_MODE_ROT0;
+
+		return vTemp;
+	}
 
 	if (force_vtemp)
 		goto copy_to_vtemp;
@@ -669,8 +1188,9 @@ static int etnaviv_accel_composite_srconly(PicturePtr pSrc, PicturePtr pDst,
 	if (pSrc->alphaMap)
 		return FALSE;
 
-	/* If the source has no drawable, and is not solid, fallback */
-	if (!pSrc->pDrawable && !picture_is_solid(pSrc, NULL))
+	/* No drawable, and neither solid nor a gradient: fallback */
+	if (!pSrc->pDrawable && !picture_is_solid(pSrc, NULL) &&
+	    !etnaviv_pict_is_gradient(pSrc))
 		return FALSE;
 
 	src_topleft.x = xSrc;
@@ -765,8 +1285,9 @@ static int etnaviv_accel_composite_masked(PicturePtr pSrc, PicturePtr pMask,
 	if (pSrc->alphaMap || pMask->alphaMap)
 		goto fallback;
 
-	/* If the source has no drawable, and is not solid, fallback */
-	if (!pSrc->pDrawable && !picture_is_solid(pSrc, NULL))
+	/* No drawable, and neither solid nor a gradient: fallback */
+	if (!pSrc->pDrawable && !picture_is_solid(pSrc, NULL) &&
+	    !etnaviv_pict_is_gradient(pSrc))
 		goto fallback;
 
 	mask_op = etnaviv_composite_op[PictOpInReverse];
@@ -841,6 +1362,257 @@ fallback:
 	goto finish;
 }
 
+/*
+ * PE1.0 has no per-component blend factors, so component alpha can't
+ * be performed using DE_BLENDMODE_COLOR.  However, the component alpha
+ * operation for channel C is:
+ *  dst.C = (src.C * mask.C) * Fa(dst.A) + dst.C * Fb(src.A * mask.C)
+ * which is an ordinary blend of (src IN mask.C) OP dst, of which we
+ * keep just channel C.  The result is built in a copy of the destination,
+ * which is only written back once every channel has been computed.  So,
+ * for each channel:
+ *  1. extract mask.C to the alpha channel of a temporary, by viewing the
+ *     32bpp mask as an INDEX8 image four times as wide, and stretching
+ *     it 4:1 horizontally starting at the channel's byte, with a palette
+ *     mapping the index to alpha.
+ *  2. compute (src IN mask.C) with a PictOpIn blend.
+ *  3. blend the copy of the destination underneath that, using OP with
+ *     the source and destination factors exchanged.
+ *  4. merge channel C into the copy using a ROP, with the brush colour
+ *     acting as the channel mask.
+ * Channel C of the copy is only read by its own pass, and the alpha
+ * channel is done last, as Fa may depend on dst.A.
+ */
+static uint32_t etnaviv_ca_palette[256];
+
+static Bool etnaviv_accel_need_ca_passes(struct etnaviv *etnaviv,
+	PicturePtr pMask)
+{
+	return pMask->componentAlpha && PICT_FORMAT_RGB(pMask->format) &&
+	       !VIV_FEATURE(etnaviv->conn, chipMinorFeatures0, 2DPE20);
+}
+
+static Bool etnaviv_ca_extract(struct etnaviv *etnaviv,
+	struct etnaviv_pixmap *vChan, struct etnaviv_pixmap *vMask,
+	xPoint mask_offset, const BoxRec *clip, unsigned int byte)
+{
+	static const struct etnaviv_format fmt_index8 = {
+		.format = DE_FORMAT_INDEX8,
+		.swizzle = DE_SWIZZLE_ARGB,
+	};
+	struct etnaviv_de_op op = {
+		.clip = clip,
+		.src_origin_mode = SRC_ORIGIN_ABSOLUTE,
+		.rop = 0xcc,
+		.cmd = VIVS_DE_DEST_CONFIG_COMMAND_STRETCH_BLT,
+		.brush = FALSE,
+		.h_scale = 4 << 16,
+		.v_scale = 1 << 16,
+	};
+	xPoint origin;
+
+	if (!etnaviv_map_gpu(etnaviv, vChan, GPU_ACCESS_RW) ||
+	    !etnaviv_map_gpu(etnaviv, vMask, GPU_ACCESS_RO))
+		return FALSE;
+
+	/* Each byte of the mask becomes a separate 8-bit index */
+	op.src = INIT_BLIT_BUF(fmt_index8, vMask, vMask->etna_bo,
+			       vMask->pitch, ZERO_OFFSET, vMask->width * 4,
+			       vMask->height, DE_ROT_MODE_ROT0);
+	op.dst = INIT_BLIT_PIX(vChan, vChan->pict_format, ZERO_OFFSET);
+
+	origin.x = (clip->x1 + mask_offset.x) * 4 + byte;
+	origin.y = clip->y1 + mask_offset.y;
+
+	etna_set_state_multi(etnaviv->ctx, VIVS_DE_INDEX_COLOR_TABLE(0),
+			     ARRAY_SIZE(etnaviv_ca_palette),
+			     etnaviv_ca_palette);
+
+	etnaviv_batch_start(etnaviv, &op);
+	etnaviv_de_op_src_origin(etnaviv, &op, origin, clip);
+	etnaviv_de_end(etnaviv);
+
+	return TRUE;
+}
+
+static Bool etnaviv_accel_composite_ca(PicturePtr pSrc, PicturePtr pMask,
+	PicturePtr pDst, INT16 xSrc, INT16 ySrc, INT16 xMask, INT16 yMask,
+	INT16 xDst, INT16 yDst, struct etnaviv_composite_state *state)
+{
+	/* Byte offsets of R, G, B, A within the mask pixel */
+	static const uint8_t argb_bytes[] = { 2, 1, 0, 3 };
+	static const uint8_t abgr_bytes[] = { 0, 1, 2, 3 };
+	/* and the corresponding destination channel masks */
+	static const uint32_t chan_mask[] = {
+		0x00ff0000, 0x0000ff00, 0x000000ff, 0xff000000,
+	};
+	ScreenPtr pScreen = pDst->pDrawable->pScreen;
+	struct etnaviv *etnaviv = etnaviv_get_screen_priv(pScreen);
+	struct etnaviv_pixmap *vSrc, *vMask, *vChan, *vDCopy;
+	PixmapPtr pPixChan = NULL, pPixDCopy = NULL;
+	struct etnaviv_de_op op;
+	struct etnaviv_blend_op rev_blend = { };
+	const uint8_t *bytes;
+	BoxRec clip_temp;
+	xPoint src_topleft, mask_offset, dst_topleft, copy_offset;
+	unsigned int i, nchan;
+	Bool ret = FALSE;
+
+	if (pSrc->alphaMap || pMask->alphaMap || !pMask->pDrawable)
+		return FALSE;
+
+	/* No drawable, and neither solid nor a gradient: fallback */
+	if (!pSrc->pDrawable && !picture_is_solid(pSrc, NULL) &&
+	    !etnaviv_pict_is_gradient(pSrc))
+		return FALSE;
+
+	/* The channel masks assume a 32bpp ARGB destination */
+	if (state->dst.format.format != DE_FORMAT_A8R8G8B8 ||
+	    state->dst.format.swizzle != DE_SWIZZLE_ARGB)
+		return FALSE;
+
+	switch (pMask->format) {
+	case PICT_a8r8g8b8:
+	case PICT_x8r8g8b8:
+		bytes = argb_bytes;
+		break;
+	case PICT_a8b8g8r8:
+	case PICT_x8b8g8r8:
+		bytes = abgr_bytes;
+		break;
+	default:
+		return FALSE;
+	}
+
+	src_topleft.x = xSrc;
+	src_topleft.y = ySrc;
+	mask_offset.x = xMask;
+	mask_offset.y = yMask;
+
+	/* Include the destination drawable's position on the pixmap */
+	xDst += pDst->pDrawable->x;
+	yDst += pDst->pDrawable->y;
+
+	/*
+	 * Compute the temporary image clipping box, which is the
+	 * clipping region extents without the destination offset.
+	 */
+	clip_temp = *RegionExtents(&state->region);
+	clip_temp.x1 -= xDst;
+	clip_temp.y1 -= yDst;
+	clip_temp.x2 -= xDst;
+	clip_temp.y2 -= yDst;
+
+	vMask = etnaviv_acquire_drawable_picture(pScreen, pMask, &clip_temp,
+						 &mask_offset, NULL);
+	if (!vMask || vMask->width * 4 > 65535)
+		return FALSE;
+
+	vSrc = etnaviv_acquire_src(pScreen, pSrc, &clip_temp, &state->pPixTemp,
+				   &src_topleft, NULL, TRUE);
+	if (!vSrc)
+		return FALSE;
+
+	vChan = etnaviv_get_scratch_argb(pScreen, &pPixChan,
+					 clip_temp.x2, clip_temp.y2);
+	vDCopy = etnaviv_get_scratch_argb(pScreen, &pPixDCopy,
+					  clip_temp.x2, clip_temp.y2);
+	if (!vChan || !vDCopy)
+		goto out;
+
+	/* The copy must be blended as if it were the destination */
+	vDCopy->pict_format = state->dst.format;
+
+	/* (src IN mask.C) OP dst == dst OP' (src IN mask.C) */
+	rev_blend.src_mode = state->final_blend.dst_mode;
+	rev_blend.dst_mode = state->final_blend.src_mode;
+
+	dst_topleft.x = xDst + state->dst.offset.x;
+	dst_topleft.y = yDst + state->dst.offset.y;
+	copy_offset.x = -dst_topleft.x;
+	copy_offset.y = -dst_topleft.y;
+
+	/* vDCopy = dst */
+	if (!etnaviv_blend(etnaviv, &clip_temp, NULL, vDCopy, state->dst.pix,
+			   &clip_temp, 1, dst_topleft, ZERO_OFFSET))
+		goto out;
+
+	/* Merge: (brush & vChan) | (~brush & vDCopy) */
+	op.dst = INIT_BLIT_PIX(vDCopy, vDCopy->pict_format, ZERO_OFFSET);
+	op.src = INIT_BLIT_PIX(vChan, vChan->pict_format, ZERO_OFFSET);
+	op.blend_op = NULL;
+	op.clip = &clip_temp;
+	op.src_origin_mode = SRC_ORIGIN_RELATIVE;
+	op.rop = 0xca;
+	op.cmd = VIVS_DE_DEST_CONFIG_COMMAND_BIT_BLT;
+	op.brush = TRUE;
+	op.pattern = INIT_BLIT_NULL;
+	op.stipple = NULL;
+
+	nchan = PICT_FORMAT_A(pDst->format) ? 4 : 3;
+	for (i = 0; i < nchan; i++) {
+		/* vChan.A = mask.C; a mask without alpha has mask.A = 1 */
+		if (i == 3 && !PICT_FORMAT_A(pMask->format)) {
+			if (!etnaviv_fill_single(etnaviv, vChan, &clip_temp,
+						 0xff000000))
+				goto out;
+		} else if (!etnaviv_ca_extract(etnaviv, vChan, vMask,
+					       mask_offset, &clip_temp,
+					       bytes[i])) {
+			goto out;
+		}
+
+		/* vChan = src IN mask.C */
+		if (!etnaviv_blend(etnaviv, &clip_temp,
+				   &etnaviv_composite_op[PictOpIn], vChan, vSrc,
+				   &clip_temp, 1, src_topleft, ZERO_OFFSET))
+			goto out;
+
+		/* vChan = (src IN mask.C) OP dst */
+		if (!etnaviv_blend(etnaviv, &clip_temp, &rev_blend, vChan,
+				   vDCopy, &clip_temp, 1, ZERO_OFFSET,
+				   ZERO_OFFSET))
+			goto out;
+
+		if (!etnaviv_map_gpu(etnaviv, vDCopy, GPU_ACCESS_RW) ||
+		    !etnaviv_map_gpu(etnaviv, vChan, GPU_ACCESS_RO))
+			goto out;
+
+		op.fg_colour = chan_mask[i];
+
+		etnaviv_batch_start(etnaviv, &op);
+		etnaviv_de_op(etnaviv, &op, &clip_temp, 1);
+		etnaviv_de_end(etnaviv);
+	}
+
+	/* Finally, write the result to the destination */
+	if (!etnaviv_map_gpu(etnaviv, state->dst.pix, GPU_ACCESS_RW) ||
+	    !etnaviv_map_gpu(etnaviv, vDCopy, GPU_ACCESS_RO))
+		goto out;
+
+	op.dst = INIT_BLIT_PIX(state->dst.pix, state->dst.format,
+			       state->dst.offset);
+	op.src = INIT_BLIT_PIX(vDCopy, vDCopy->pict_format, copy_offset);
+	op.clip = RegionExtents(&state->region);
+	op.rop = 0xcc;
+	op.brush = FALSE;
+
+	etnaviv_batch_start(etnaviv, &op);
+	etnaviv_de_op(etnaviv, &op, RegionRects(&state->region),
+		      RegionNumRects(&state->region));
+	etnaviv_de_end(etnaviv);
+
+	ret = TRUE;
+
+out:
+	if (pPixChan)
+		etnaviv_put_scratch(pScreen, pPixChan);
+	if (pPixDCopy)
+		etnaviv_put_scratch(pScreen, pPixDCopy);
+
+	return ret;
+}
+
 /*
  * Handle cases where we can reduce a (s IN m) OP d operation to
  * a simpler s OP' d operation, possibly modifying OP' to use the
@@ -1028,6 +1800,7 @@ static int etnaviv_accel_Composite(CARD8 op, PicturePtr pSrc, PicturePtr pMask,
 	ScreenPtr pScreen = pDst->pDrawable->pScreen;
 	struct etnaviv *etnaviv = etnaviv_get_screen_priv(pScreen);
 	struct etnaviv_composite_state state;
+	Bool final = TRUE;
 	int rc;
 
 #ifdef DEBUG_BLEND
@@ -1121,6 +1894,12 @@ static int etnaviv_accel_Composite(CARD8 op, PicturePtr pSrc, PicturePtr pMask,
 						     xSrc, ySrc,
 						     xDst, yDst,
 						     &state);
+	} else if (etnaviv_accel_need_ca_passes(etnaviv, pMask)) {
+		rc = etnaviv_accel_composite_ca(pSrc, pMask, pDst,
+						xSrc, ySrc, xMask, yMask,
+						xDst, yDst, &state);
+		/* The channel passes have written back the destination */
+		final = FALSE;
 	} else {
 		rc = etnaviv_accel_composite_masked(pSrc, pMask, pDst,
 						    xSrc, ySrc, xMask, yMask,
@@ -1134,7 +1913,7 @@ static int etnaviv_accel_Composite(CARD8 op, PicturePtr pSrc, PicturePtr pMask,
 	 * The above functions will have done the necessary setup for
 	 * this step.
 	 */
-	if (rc) {
+	if (rc && final) {
 		state.final_op.dst = INIT_BLIT_PIX(state.dst.pix,
 						   state.dst.format,
 						   state.dst.offset);
@@ -1169,13 +1948,22 @@ static int etnaviv_accel_Composite(CARD8 op, PicturePtr pSrc, PicturePtr pMask,
 
 	/* Destroy any temporary pixmap we may have allocated */
 	if (state.pPixTemp)
-		pScreen->DestroyPixmap(state.pPixTemp);
+		etnaviv_put_scratch(pScreen, state.pPixTemp);
 
 	RegionUninit(&state.region);
 
 	return rc;
 }
 
+/* Free a picture on a scratch pixmap, returning the pixmap to the pool */
+static void etnaviv_free_scratch_picture(ScreenPtr pScreen, PicturePtr pPict)
+{
+	PixmapPtr pPixmap = drawable_pixmap(pPict->pDrawable);
+
+	FreePicture(pPict, 0);
+	etnaviv_put_scratch(pScreen, pPixmap);
+}
+
 static Bool etnaviv_accel_Glyphs(CARD8 final_op, PicturePtr pSrc,
 	PicturePtr pDst, PictFormatPtr maskFormat, INT16 xSrc, INT16 ySrc,
 	int nlist, GlyphListPtr list, GlyphPtr *glyphs)
@@ -1204,9 +1992,8 @@ static Bool etnaviv_accel_Glyphs(CARD8 final_op, PicturePtr pSrc,
 	width = extents.x2 - extents.x1;
 	height = extents.y2 - extents.y1;
 
-	pMaskPixmap = pScreen->CreatePixmap(pScreen, width, height,
-					    maskFormat->depth,
-					    CREATE_PIXMAP_USAGE_GPU);
+	pMaskPixmap = etnaviv_get_scratch(pScreen, width, height,
+					  maskFormat->depth);
 	if (!pMaskPixmap)
 		goto destroy_gr;
 
@@ -1216,9 +2003,6 @@ static Bool etnaviv_accel_Glyphs(CARD8 final_op, PicturePtr pSrc,
 	if (!pMask)
 		goto destroy_pixmap;
 
-	/* Drop our reference to the mask pixmap */
-	pScreen->DestroyPixmap(pMaskPixmap);
-
 	vMask = etnaviv_get_pixmap_priv(pMaskPixmap);
 	/* Clear the mask to transparent */
 	fmt = etnaviv_set_format(vMask, pMask);
@@ -1279,16 +2063,16 @@ static Bool etnaviv_accel_Glyphs(CARD8 final_op, PicturePtr pSrc,
 	CompositePicture(final_op, pSrc, pMask, pDst, xSrc, ySrc, 0, 0, x, y,
 			 width, height);
 
-	FreePicture(pMask, 0);
+	etnaviv_free_scratch_picture(pScreen, pMask);
 	return TRUE;
 
 destroy_picture:
-	FreePicture(pMask, 0);
+	etnaviv_free_scratch_picture(pScreen, pMask);
 	free(gr);
 	return FALSE;
 
 destroy_pixmap:
-	pScreen->DestroyPixmap(pMaskPixmap);
+	etnaviv_put_scratch(pScreen, pMaskPixmap);
 destroy_gr:
 	free(gr);
 	return FALSE;
@@ -1380,6 +2164,259 @@ static void etnaviv_accel_glyph_upload(ScreenPtr pScreen, PicturePtr pDst,
 	etnaviv_de_end(etnaviv);
 }
 
+/*
+ * Create an A8 GPU pixmap picture covering the box, and prepare it for
+ * the CPU to rasterise coverage into it using pixman.  The pixmap stays
+ * a GPU pixmap, so the destination never needs to leave the GPU.
+ */
+static PicturePtr etnaviv_create_coverage(ScreenPtr pScreen,
+	PictFormatPtr maskFormat, const BoxRec *box, pixman_image_t **image)
+{
+	int width = box_width(box), height = box_height(box), error;
+	PixmapPtr pPixmap;
+	PicturePtr pPict;
+
+	pPixmap = etnaviv_get_scratch(pScreen, width, height, 8);
+	if (!pPixmap)
+		return NULL;
+
+	pPict = CreatePicture(0, &pPixmap->drawable, maskFormat, 0, 0,
+			      serverClient, &error);
+	if (!pPict) {
+		etnaviv_put_scratch(pScreen, pPixmap);
+		return NULL;
+	}
+
+	prepare_cpu_drawable(&pPixmap->drawable, CPU_ACCESS_RW);
+	memset(pPixmap->devPrivate.ptr, 0, pPixmap->devKind * height);
+
+	*image = pixman_image_create_bits(PIXMAN_a8, width, height,
+					  pPixmap->devPrivate.ptr,
+					  pPixmap->devKind);
+	if (!*image) {
+		finish_cpu_drawable(&pPixmap->drawable, CPU_ACCESS_RW);
+		etnaviv_free_scratch_picture(pScreen, pPict);
+		return NULL;
+	}
+
+	return pPict;
+}
+
+static void etnaviv_finish_coverage(PicturePtr pPict, pixman_image_t *image)
+{
+	pixman_image_unref(image);
+	finish_cpu_drawable(pPict->pDrawable, CPU_ACCESS_RW);
+}
+
+/*
+ * Clip the (drawable relative) bounds to the picture's composite clip.
+ * Returns FALSE if there is nothing to be drawn.
+ */
+static Bool etnaviv_clip_bounds(PicturePtr pDst, BoxPtr bounds)
+{
+	BoxRec clip = *RegionExtents(pDst->pCompositeClip);
+
+	clip.x1 -= pDst->pDrawable->x;
+	clip.y1 -= pDst->pDrawable->y;
+	clip.x2 -= pDst->pDrawable->x;
+	clip.y2 -= pDst->pDrawable->y;
+
+	return !__box_intersect(bounds, bounds, &clip);
+}
+
+static Bool etnaviv_accel_Trapezoids(CARD8 op, PicturePtr pSrc,
+	PicturePtr pDst, PictFormatPtr maskFormat, INT16 xSrc, INT16 ySrc,
+	int ntrap, xTrapezoid *traps)
+{
+	ScreenPtr pScreen = pDst->pDrawable->pScreen;
+	pixman_image_t *image;
+	PicturePtr pMask;
+	BoxRec bounds;
+	INT16 xDst, yDst;
+
+	/* Only A8 coverage can be rendered into a GPU pixmap */
+	if (maskFormat->format != PICT_a8)
+		return FALSE;
+
+	miTrapezoidBounds(ntrap, traps, &bounds);
+	if (!etnaviv_clip_bounds(pDst, &bounds))
+		return TRUE;
+
+	pMask = etnaviv_create_coverage(pScreen, maskFormat, &bounds, &image);
+	if (!pMask)
+		return FALSE;
+
+	pixman_add_trapezoids(image, -bounds.x1, -bounds.y1, ntrap,
+			      (pixman_trapezoid_t *)traps);
+
+	etnaviv_finish_coverage(pMask, image);
+
+	xDst = traps[0].left.p1.x >> 16;
+	yDst = traps[0].left.p1.y >> 16;
+
+	CompositePicture(op, pSrc, pMask, pDst,
+			 xSrc + bounds.x1 - xDst, ySrc + bounds.y1 - yDst,
+			 0, 0, bounds.x1, bounds.y1,
+			 box_width(&bounds), box_height(&bounds));
+
+	etnaviv_free_scratch_picture(pScreen, pMask);
+
+	return TRUE;
+}
+
+static Bool etnaviv_accel_Triangles(CARD8 op, PicturePtr pSrc,
+	PicturePtr pDst, PictFormatPtr maskFormat, INT16 xSrc, INT16 ySrc,
+	int ntri, xTriangle *tris)
+{
+	ScreenPtr pScreen = pDst->pDrawable->pScreen;
+	pixman_image_t *image;
+	PicturePtr pMask;
+	BoxRec bounds;
+	INT16 xDst, yDst;
+
+	/* Only A8 coverage can be rendered into a GPU pixmap */
+	if (maskFormat->format != PICT_a8)
+		return FALSE;
+
+	miTriangleBounds(ntri, tris, &bounds);
+	if (!etnaviv_clip_bounds(pDst, &bounds))
+		return TRUE;
+
+	pMask = etnaviv_create_coverage(pScreen, maskFormat, &bounds, &image);
+	if (!pMask)
+		return FALSE;
+
+	pixman_add_triangles(image, -bounds.x1, -bounds.y1, ntri,
+			     (pixman_triangle_t *)tris);
+
+	etnaviv_finish_coverage(pMask, image);
+
+	xDst = tris[0].p1.x >> 16;
+	yDst = tris[0].p1.y >> 16;
+
+	CompositePicture(op, pSrc, pMask, pDst,
+			 xSrc + bounds.x1 - xDst, ySrc + bounds.y1 - yDst,
+			 0, 0, bounds.x1, bounds.y1,
+			 box_width(&bounds), box_height(&bounds));
+
+	etnaviv_free_scratch_picture(pScreen, pMask);
+
+	return TRUE;
+}
+
+/*
+ * AddTraps and AddTriangles add coverage to an existing alpha picture.
+ * Rasterise the coverage into a temporary A8 GPU pixmap, and add it to
+ * the picture using a PictOpAdd composite.  This only gives the same
+ * result as pixman for an unclipped A8 picture: other formats would
+ * be rounded differently, and the composite would apply the clip.
+ */
+static Bool etnaviv_accel_can_add_coverage(PicturePtr pPicture)
+{
+	return pPicture->format == PICT_a8 && !pPicture->clientClip &&
+	       !pPicture->alphaMap;
+}
+
+static Bool etnaviv_accel_add_coverage(PicturePtr pPicture,
+	const BoxRec *bounds, PicturePtr pCoverage)
+{
+	CompositePicture(PictOpAdd, pCoverage, NULL, pPicture, 0, 0, 0, 0,
+			 bounds->x1, bounds->y1,
+			 box_width(bounds), box_height(bounds));
+	etnaviv_free_scratch_picture(pPicture->pDrawable->pScreen, pCoverage);
+
+	return TRUE;
+}
+
+static Bool etnaviv_accel_AddTraps(PicturePtr pPicture, INT16 x_off,
+	INT16 y_off, int ntrap, xTrap *traps)
+{
+	ScreenPtr pScreen = pPicture->pDrawable->pScreen;
+	PictFormatPtr format;
+	pixman_image_t *image;
+	PicturePtr pCoverage;
+	BoxRec bounds;
+	xFixed x1, x2;
+	int i;
+
+	if (!etnaviv_accel_can_add_coverage(pPicture))
+		return FALSE;
+
+	format = PictureMatchFormat(pScreen, 8, PICT_a8);
+	if (!format)
+		return FALSE;
+
+	bounds.x1 = bounds.y1 = MAXSHORT;
+	bounds.x2 = bounds.y2 = MINSHORT;
+	for (i = 0; i < ntrap; i++) {
+		x1 = mint(traps[i].top.l, traps[i].bot.l);
+		x2 = maxt(traps[i].top.r, traps[i].bot.r);
+
+		bounds.x1 = mint(bounds.x1, xFixedToInt(x1));
+		bounds.x2 = maxt(bounds.x2, xFixedToInt(xFixedCeil(x2)));
+		bounds.y1 = mint(bounds.y1, xFixedToInt(traps[i].top.y));
+		bounds.y2 = maxt(bounds.y2,
+				 xFixedToInt(xFixedCeil(traps[i].bot.y)));
+	}
+
+	bounds.x1 += x_off;
+	bounds.y1 += y_off;
+	bounds.x2 += x_off;
+	bounds.y2 += y_off;
+
+	if (!etnaviv_clip_bounds(pPicture, &bounds))
+		return TRUE;
+
+	pCoverage = etnaviv_create_coverage(pScreen, format, &bounds, &image);
+	if (!pCoverage)
+		return FALSE;
+
+	pixman_add_traps(image, x_off - bounds.x1, y_off - bounds.y1, ntrap,
+			 (pixman_trap_t *)traps);
+
+	etnaviv_finish_coverage(pCoverage, image);
+
+	return etnaviv_accel_add_coverage(pPicture, &bounds, pCoverage);
+}
+
+static Bool etnaviv_accel_AddTriangles(PicturePtr pPicture, INT16 x_off,
+	INT16 y_off, int ntri, xTriangle *tris)
+{
+	ScreenPtr pScreen = pPicture->pDrawable->pScreen;
+	PictFormatPtr format;
+	pixman_image_t *image;
+	PicturePtr pCoverage;
+	BoxRec bounds;
+
+	if (!etnaviv_accel_can_add_coverage(pPicture))
+		return FALSE;
+
+	format = PictureMatchFormat(pScreen, 8, PICT_a8);
+	if (!format)
+		return FALSE;
+
+	miTriangleBounds(ntri, tris, &bounds);
+
+	bounds.x1 += x_off;
+	bounds.y1 += y_off;
+	bounds.x2 += x_off;
+	bounds.y2 += y_off;
+
+	if (!etnaviv_clip_bounds(pPicture, &bounds))
+		return TRUE;
+
+	pCoverage = etnaviv_create_coverage(pScreen, format, &bounds, &image);
+	if (!pCoverage)
+		return FALSE;
+
+	pixman_add_triangles(image, x_off - bounds.x1, y_off - bounds.y1,
+			     ntri, (pixman_triangle_t *)tris);
+
+	etnaviv_finish_coverage(pCoverage, image);
+
+	return etnaviv_accel_add_coverage(pPicture, &bounds, pCoverage);
+}
+
 static void
 etnaviv_Composite(CARD8 op, PicturePtr pSrc, PicturePtr pMask, PicturePtr pDst,
 	INT16 xSrc, INT16 ySrc, INT16 xMask, INT16 yMask, INT16 xDst, INT16 yDst,
@@ -1412,6 +2449,91 @@ static void etnaviv_Glyphs(CARD8 op, PicturePtr pSrc, PicturePtr pDst,
 			       xSrc, ySrc, nlist, list, glyphs);
 }
 
+static void etnaviv_Trapezoids(CARD8 op, PicturePtr pSrc, PicturePtr pDst,
+	PictFormatPtr maskFormat, INT16 xSrc, INT16 ySrc, int ntrap,
+	xTrapezoid *traps)
+{
+	ScreenPtr pScreen = pDst->pDrawable->pScreen;
+	struct etnaviv *etnaviv = etnaviv_get_screen_priv(pScreen);
+
+	if (!etnaviv->force_fallback) {
+		if (maskFormat) {
+			if (etnaviv_accel_Trapezoids(op, pSrc, pDst, maskFormat,
+						     xSrc, ySrc, ntrap, traps))
+				return;
+		} else if (pDst->polyEdge == PolyEdgeSmooth) {
+			PictFormatPtr a8 = PictureMatchFormat(pScreen, 8,
+							      PICT_a8);
+
+			/* Each trapezoid is composited separately */
+			if (a8) {
+				for (; ntrap; ntrap--, traps++)
+					if (!etnaviv_accel_Trapezoids(op, pSrc,
+							pDst, a8, xSrc, ySrc,
+							1, traps))
+						unaccel_Trapezoids(op, pSrc,
+							pDst, NULL, xSrc, ySrc,
+							1, traps);
+				return;
+			}
+		}
+	}
+	unaccel_Trapezoids(op, pSrc, pDst, maskFormat, xSrc, ySrc,
+			   ntrap, traps);
+}
+
+static void etnaviv_Triangles(CARD8 op, PicturePtr pSrc, PicturePtr pDst,
+	PictFormatPtr maskFormat, INT16 xSrc, INT16 ySrc, int ntri,
+	xTriangle *tris)
+{
+	ScreenPtr pScreen = pDst->pDrawable->pScreen;
+	struct etnaviv *etnaviv = etnaviv_get_screen_priv(pScreen);
+
+	if (!etnaviv->force_fallback) {
+		if (maskFormat) {
+			if (etnaviv_accel_Triangles(op, pSrc, pDst, maskFormat,
+						    xSrc, ySrc, ntri, tris))
+				return;
+		} else if (pDst->polyEdge == PolyEdgeSmooth) {
+			PictFormatPtr a8 = PictureMatchFormat(pScreen, 8,
+							      PICT_a8);
+
+			/* Each triangle is composited separately */
+			if (a8) {
+				for (; ntri; ntri--, tris++)
+					if (!etnaviv_accel_Triangles(op, pSrc,
+							pDst, a8, xSrc, ySrc,
+							1, tris))
+						unaccel_Triangles(op, pSrc,
+							pDst, NULL, xSrc, ySrc,
+							1, tris);
+				return;
+			}
+		}
+	}
+	unaccel_Triangles(op, pSrc, pDst, maskFormat, xSrc, ySrc, ntri, tris);
+}
+
+static void etnaviv_AddTraps(PicturePtr pPicture, INT16 x_off, INT16 y_off,
+	int ntrap, xTrap *traps)
+{
+	struct etnaviv *etnaviv = etnaviv_get_screen_priv(pPicture->pDrawable->pScreen);
+
+	if (etnaviv->force_fallback ||
+	    !etnaviv_accel_AddTraps(pPicture, x_off, y_off, ntrap, traps))
+		unaccel_AddTraps(pPicture, x_off, y_off, ntrap, traps);
+}
+
+static void etnaviv_AddTriangles(PicturePtr pPicture, INT16 x_off,
+	INT16 y_off, int ntri, xTriangle *tris)
+{
+	struct etnaviv *etnaviv = etnaviv_get_screen_priv(pPicture->pDrawable->pScreen);
+
+	if (etnaviv->force_fallback ||
+	    !etnaviv_accel_AddTriangles(pPicture, x_off, y_off, ntri, tris))
+		unaccel_AddTriangles(pPicture, x_off, y_off, ntri, tris);
+}
+
 static void etnaviv_UnrealizeGlyph(ScreenPtr pScreen, GlyphPtr glyph)
 {
 	struct etnaviv *etnaviv = etnaviv_get_screen_priv(pScreen);
@@ -1462,6 +2584,16 @@ void etnaviv_render_screen_init(ScreenPtr pScreen)
 {
 	struct etnaviv *etnaviv = etnaviv_get_screen_priv(pScreen);
 	PictureScreenPtr ps = GetPictureScreenIfSet(pScreen);
+	unsigned int i;
+
+	etnaviv->gradient_cache = calloc(1, sizeof(*etnaviv->gradient_cache));
+
+	etnaviv_init_filter_kernel(etnaviv_bilinear_kernel, FILTER_BILINEAR);
+	etnaviv_init_filter_kernel(etnaviv_lanczos_kernel, FILTER_LANCZOS);
+
+	/* Index to alpha palette for component alpha on PE1.0 */
+	for (i = 0; i < ARRAY_SIZE(etnaviv_ca_palette); i++)
+		etnaviv_ca_palette[i] = i << 24;
 
 	if (!etnaviv->force_fallback) {
 		etnaviv->CreateScreenResources = pScreen->CreateScreenResources;
@@ -1475,13 +2607,13 @@ void etnaviv_render_screen_init(ScreenPtr pScreen)
 	etnaviv->UnrealizeGlyph = ps->UnrealizeGlyph;
 	ps->UnrealizeGlyph = etnaviv_UnrealizeGlyph;
 	etnaviv->Triangles = ps->Triangles;
-	ps->Triangles = unaccel_Triangles;
+	ps->Triangles = etnaviv_Triangles;
 	etnaviv->Trapezoids = ps->Trapezoids;
-	ps->Trapezoids = unaccel_Trapezoids;
+	ps->Trapezoids = etnaviv_Trapezoids;
 	etnaviv->AddTriangles = ps->AddTriangles;
-	ps->AddTriangles = unaccel_AddTriangles;
+	ps->AddTriangles = etnaviv_AddTriangles;
 	etnaviv->AddTraps = ps->AddTraps;
-	ps->AddTraps = unaccel_AddTraps;
+	ps->AddTraps = etnaviv_AddTraps;
 }
 
 void etnaviv_render_close_screen(ScreenPtr pScreen)
@@ -1489,6 +2621,11 @@ void etnaviv_render_close_screen(ScreenPtr pScreen)
 	struct etnaviv *etnaviv = etnaviv_get_screen_priv(pScreen);
 	PictureScreenPtr ps = GetPictureScreenIfSet(pScreen);
 
+	if (etnaviv->gradient_cache) {
+		etnaviv_gradient_cache_fini(pScreen, etnaviv->gradient_cache);
+		etnaviv->gradient_cache = NULL;
+	}
+
 	/* Restore the Pointers */
 	ps->Composite = etnaviv->Composite;
 	ps->Glyphs = etnaviv->Glyphs;
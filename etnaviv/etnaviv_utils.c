@@ -254,7 +254,8 @@ void prepare_cpu_drawable(DrawablePtr pDrawable, int access)
 Bool etnaviv_src_format_valid(struct etnaviv *etnaviv,
 	struct etnaviv_format fmt)
 {
-	if (fmt.format == DE_FORMAT_YV12 &&
+	/* Planar and semi-planar YUV sources need the YUV420 scaler */
+	if (fmt.planes > 1 &&
 	    !VIV_FEATURE(etnaviv->conn, chipFeatures, YUV420_SCALER))
 		return FALSE;
 	if ((fmt.format >= 16 || fmt.swizzle) &&
@@ -13,9 +13,12 @@
 #include "config.h"
 #endif
 
+#include <string.h>
 #include <sys/mman.h>
 
 #include "xf86.h"
+#include "dix.h"
+#include "resource.h"
 #include "xf86Crtc.h"
 #include "xf86xv.h"
 #include "damage.h"
@@ -31,9 +34,11 @@
 #include "xvbo.h"
 
 #include "armada_accel.h"
+#include "common_drm.h"
 #include "common_drm_helper.h"
 
 #include "etnaviv_accel.h"
+#include "etnaviv_filter.h"
 #include "etnaviv_op.h"
 #include "etnaviv_utils.h"
 #include "etnaviv_xv.h"
@@ -43,6 +48,14 @@
 #include <etnaviv/state_2d.xml.h>
 #include "etnaviv_compat.h"
 
+/* Semi-planar source formats, PE2.0 and later */
+#ifndef DE_FORMAT_NV12
+#define DE_FORMAT_NV12	0x00000011
+#endif
+#ifndef DE_FORMAT_NV16
+#define DE_FORMAT_NV16	0x00000012
+#endif
+
 /*
  * The Vivante GPU supports up to 32k x 32k, but that would be
  * 2GB in 16bpp.  Limit to 4k x 4k, which gives us 32M.
@@ -50,6 +63,21 @@
 #define ETNAVIV_XV_MAX_WIDTH  4096
 #define ETNAVIV_XV_MAX_HEIGHT 4096
 
+/*
+ * Number of staging buffers per port used to hold copies of non-SHM
+ * images while the GPU is still reading the previous frames.
+ */
+#define XV_STAGING_BUFS	3
+
+/*
+ * Number of ports, and the maximum number of vertical filter (stage 1)
+ * buffers shared between them.  Each port holds at most one buffer
+ * across a PutImage call, and further buffers are only allocated when
+ * every existing buffer is still in use by the GPU.
+ */
+#define XV_NR_PORTS	16
+#define XV_STAGE1_BUFS	XV_NR_PORTS
+
 static XF86VideoEncodingRec etnaviv_encodings[] = {
 	{
 		.id = 0,
@@ -107,6 +135,22 @@ static const struct etnaviv_format fmt_i420 = {
 	.v = 2,
 };
 
+static const struct etnaviv_format fmt_nv12 = {
+	.format = DE_FORMAT_NV12,
+	.swizzle = DE_SWIZZLE_ARGB,
+	.planes = 2,
+	.u = 1,
+	.v = 1,
+};
+
+static const struct etnaviv_format fmt_nv16 = {
+	.format = DE_FORMAT_NV16,
+	.swizzle = DE_SWIZZLE_ARGB,
+	.planes = 2,
+	.u = 1,
+	.v = 1,
+};
+
 static const struct xv_image_format etnaviv_image_formats[] = {
 	{
 		.u.data = &fmt_uyvy,
@@ -120,29 +164,112 @@ static const struct xv_image_format etnaviv_image_formats[] = {
 	}, {
 		.u.data = &fmt_i420,
 		.xv_image = XVIMAGE_I420,
+	}, {
+		.u.data = &fmt_nv12,
+		.xv_image = XVIMAGE_NV12,
+	}, {
+		.u.data = &fmt_nv16,
+		.xv_image = XVIMAGE_NV16,
 	}, {
 		.u.data = &fmt_xrgb8888,
 		.xv_image = XVIMAGE_XRGB8888,
 	}, {
 		.u.data = NULL,
 		.xv_image = XVIMAGE_XVBO,
+	}, {
+		.u.data = NULL,
+		.xv_image = XVIMAGE_XVPX,
 	},
 };
 
-#define KERNEL_ROWS	17
-#define KERNEL_INDICES	9
-#define KERNEL_SIZE	(KERNEL_ROWS * KERNEL_INDICES)
-#define KERNEL_STATE_SZ	((KERNEL_SIZE + 1) / 2)
+/*
+ * Lanczos kernels stretched for downscaling, indexed by the bucket
+ * returned from etnaviv_xv_filter_bucket().  Upscaling uses the
+ * unstretched kernel in bucket 0.
+ */
+#define XV_FILTER_BUCKETS	5
+
+static const float xv_filter_scales[XV_FILTER_BUCKETS] = {
+	1.0, 1.5, 2.0, 3.0, 4.0,
+};
+static uint32_t xv_filter_bilinear[KERNEL_STATE_SZ];
+static uint32_t xv_filter_scaled[XV_FILTER_BUCKETS][KERNEL_STATE_SZ];
+/* A [1 2 1] vertical blend of each line with its neighbours */
+static uint32_t xv_filter_blend[KERNEL_STATE_SZ];
+
+enum {
+	XV_FILTER_FAST,		/* bilinear */
+	XV_FILTER_LANCZOS,	/* lanczos, regardless of scale */
+	XV_FILTER_ADAPTIVE,	/* lanczos, stretched according to scale */
+};
 
-static uint32_t xv_filter_kernel[KERNEL_STATE_SZ];
+/*
+ * Bob displays a single field, line doubled by the vertical filter.
+ * Clients alternate between the top and bottom fields, displaying
+ * each frame twice, to show every field.
+ */
+enum {
+	XV_DEINTERLACE_NONE,
+	XV_DEINTERLACE_BOB_TOP,
+	XV_DEINTERLACE_BOB_BOTTOM,
+	XV_DEINTERLACE_BLEND,
+};
 
 enum {
 	attr_sync_to_vblank,
+	attr_pipelined,
+	attr_filter_quality,
+	attr_deinterlace,
 	attr_last_prop,
 	attr_pipe = attr_last_prop,
 	attr_encoding,
 };
 
+struct etnaviv_xv_priv;
+
+struct etnaviv_xv_staging {
+	struct etnaviv_fence fence;
+	struct etna_bo *bo;
+	void *ptr;
+	size_t size;
+};
+
+struct etnaviv_xv_stage1 {
+	struct etnaviv_fence fence;
+	struct etna_bo *bo;
+	size_t size;
+	Bool busy;		/* held by a deferred blit */
+};
+
+struct etnaviv_xv_stage1_pool {
+	struct etnaviv_xv_stage1 buf[XV_STAGE1_BUFS];
+	size_t size;		/* largest stage 1 size requested */
+	unsigned users;		/* ports which have used the pool */
+};
+
+struct etnaviv_xv_vblank {
+	struct common_drm_event base;
+	struct etnaviv_xv_priv *priv;
+};
+
+/* The final stage of a frame, waiting for the next vblank */
+struct etnaviv_xv_pending {
+	struct etnaviv_xv_vblank *event;
+	struct etnaviv_vr_op op;
+	uint32_t pitches[3];
+	uint32_t offsets[3];
+	BoxRec dst;
+	uint32_t x1;
+	uint32_t y1;
+	RegionRec clip;
+	PixmapPtr pixmap;
+	PixmapPtr src_pixmap;
+	XID drawable;
+	struct etnaviv_usermem_node *unode;
+	struct etnaviv_xv_staging *staging;
+	struct etnaviv_xv_stage1 *stage1;
+};
+
 struct etnaviv_xv_priv {
 	struct etnaviv *etnaviv;
 	xf86CrtcPtr desired_crtc;
@@ -158,8 +285,12 @@ struct etnaviv_xv_priv {
 	struct etnaviv_format source_format;
 	struct etnaviv_format stage1_format;
 	uint32_t stage1_pitch;
-	size_t stage1_size;
-	struct etna_bo *stage1_bo;
+	struct etnaviv_xv_stage1_pool *stage1_pool;
+	Bool stage1_user;
+
+	struct etnaviv_xv_staging staging[XV_STAGING_BUFS];
+	unsigned staging_next;
+	struct etnaviv_xv_pending pending;
 
 	INT32 props[attr_last_prop];
 };
@@ -183,6 +314,24 @@ static XF86AttributeRec etnaviv_xv_attributes[] = {
 		.max_value = 1,
 		.name = "XV_SYNC_TO_VBLANK",
 	},
+	[attr_pipelined] = {
+		.flags = XvSettable | XvGettable,
+		.min_value = 0,
+		.max_value = 1,
+		.name = "XV_PIPELINED",
+	},
+	[attr_filter_quality] = {
+		.flags = XvSettable | XvGettable,
+		.min_value = XV_FILTER_FAST,
+		.max_value = XV_FILTER_ADAPTIVE,
+		.name = "XV_FILTER_QUALITY",
+	},
+	[attr_deinterlace] = {
+		.flags = XvSettable | XvGettable,
+		.min_value = XV_DEINTERLACE_NONE,
+		.max_value = XV_DEINTERLACE_BLEND,
+		.name = "XV_DEINTERLACE",
+	},
 };
 
 static int etnaviv_xv_set_encoding(ScrnInfoPtr pScrn,
@@ -267,8 +416,63 @@ static struct xv_attr_data etnaviv_attributes[] = {
 		.get = etnaviv_xv_get_prop,
 		.attr = &etnaviv_xv_attributes[attr_sync_to_vblank],
 	},
+	[attr_pipelined] = {
+		.id = attr_pipelined,
+		.set = etnaviv_xv_set_prop,
+		.get = etnaviv_xv_get_prop,
+		.attr = &etnaviv_xv_attributes[attr_pipelined],
+	},
+	[attr_filter_quality] = {
+		.id = attr_filter_quality,
+		.set = etnaviv_xv_set_prop,
+		.get = etnaviv_xv_get_prop,
+		.attr = &etnaviv_xv_attributes[attr_filter_quality],
+	},
+	[attr_deinterlace] = {
+		.id = attr_deinterlace,
+		.set = etnaviv_xv_set_prop,
+		.get = etnaviv_xv_get_prop,
+		.attr = &etnaviv_xv_attributes[attr_deinterlace],
+	},
 };
 
+/* Map a 16.16 source/destination ratio to a filter kernel bucket */
+static unsigned etnaviv_xv_filter_bucket(uint32_t scale)
+{
+	if (scale <= 1 << 16)
+		return 0;
+	if (scale <= 3 << 15)
+		return 1;
+	if (scale <= 2 << 16)
+		return 2;
+	if (scale <= 3 << 16)
+		return 3;
+	return 4;
+}
+
+/*
+ * Select the filter kernel for a filter blit.  The kernels are only
+ * reloaded when they change, so a stable scale factor costs nothing.
+ */
+static void etnaviv_xv_filter(struct etnaviv_xv_priv *priv, uint32_t scale)
+{
+	const uint32_t *kernel;
+
+	switch (priv->props[attr_filter_quality]) {
+	case XV_FILTER_FAST:
+		kernel = xv_filter_bilinear;
+		break;
+	case XV_FILTER_LANCZOS:
+		kernel = xv_filter_scaled[0];
+		break;
+	default:
+		kernel = xv_filter_scaled[etnaviv_xv_filter_bucket(scale)];
+		break;
+	}
+
+	etnaviv_set_filter_kernel(priv->etnaviv, kernel);
+}
+
 static const struct xv_image_format *etnaviv_get_fmt_xv(int id)
 {
 	return xv_image_xvfourcc(etnaviv_image_formats,
@@ -281,11 +485,28 @@ static int etnaviv_get_fmt_info(const struct xv_image_format *fmt,
 	uint32_t size[3];
 	int ret;
 
-	if (fmt->xv_image.id == FOURCC_XVBO) {
-		/* Our special XVBO format is only two uint32_t */
+	if (fmt->xv_image.id == FOURCC_XVBO ||
+	    fmt->xv_image.id == FOURCC_XVPX) {
+		/* Our special XVBO formats are only two uint32_t */
 		pitch[0] = 2 * sizeof(uint32_t);
 		offset[0] = 0;
 		ret = pitch[0];
+	} else if (fmt->xv_image.format == XvPlanar &&
+		   fmt->xv_image.num_planes == 2) {
+		/*
+		 * Semi-planar: a Y plane followed by an interleaved
+		 * UV plane, which has the same pitch as the Y plane.
+		 */
+		pitch[0] = ALIGN(width, 16);
+		pitch[1] = pitch[0];
+
+		size[0] = pitch[0] * height;
+		size[1] = pitch[1] * (height / fmt->xv_image.vert_u_period);
+
+		offset[0] = 0;
+		offset[1] = ALIGN(offset[0] + size[0], 64);
+
+		ret = offset[1] + size[1];
 	} else if (fmt->xv_image.format == XvPlanar) {
 		unsigned y = 0, u, v;
 
@@ -327,53 +548,389 @@ static int etnaviv_get_fmt_info(const struct xv_image_format *fmt,
 	return ALIGN(ret, getpagesize());
 }
 
-static Bool etnaviv_realloc_stage1(ScrnInfoPtr pScrn,
+/* Release the source of a frame after its last GPU operation */
+static void etnaviv_xv_release_src(struct etnaviv *etnaviv,
+	struct etnaviv_usermem_node *unode, struct etnaviv_xv_staging *staging)
+{
+	if (unode)
+		etnaviv_add_freemem(etnaviv, unode);
+	else if (staging)
+		etnaviv_fence_add(&etnaviv->fence_head, &staging->fence);
+}
+
+static void etnaviv_xv_retire_staging(struct etnaviv_fence_head *fh,
+	struct etnaviv_fence *f)
+{
+}
+
+static struct etnaviv_xv_staging *etnaviv_xv_get_staging(ScrnInfoPtr pScrn,
+	struct etnaviv_xv_priv *priv)
+{
+	struct etnaviv *etnaviv = priv->etnaviv;
+	struct etnaviv_xv_staging *staging;
+
+	staging = &priv->staging[priv->staging_next];
+	priv->staging_next = (priv->staging_next + 1) % XV_STAGING_BUFS;
+
+	/* Wait for the GPU to finish reading the previous image */
+	etnaviv_batch_wait_fence(etnaviv, &staging->fence);
+
+	if (staging->size < priv->size) {
+		if (staging->bo)
+			etna_bo_del(etnaviv->conn, staging->bo, NULL);
+
+		staging->ptr = NULL;
+		staging->size = 0;
+		staging->bo = etna_bo_new(etnaviv->conn, priv->size,
+					  DRM_ETNA_GEM_TYPE_BMP |
+					  DRM_ETNA_GEM_CACHE_WBACK);
+		if (staging->bo)
+			staging->ptr = etna_bo_map(staging->bo);
+
+		if (!staging->ptr) {
+			xf86DrvMsg(pScrn->scrnIndex, X_ERROR,
+				   "etnaviv Xv: etna_bo_new(size=%zu) failed\n",
+				   priv->size);
+			if (staging->bo)
+				etna_bo_del(etnaviv->conn, staging->bo, NULL);
+			staging->bo = NULL;
+			return NULL;
+		}
+
+		staging->size = priv->size;
+	}
+
+	return staging;
+}
+
+static void etnaviv_xv_del_staging(struct etnaviv_xv_priv *priv)
+{
+	struct etnaviv *etnaviv = priv->etnaviv;
+	unsigned i;
+
+	for (i = 0; i < XV_STAGING_BUFS; i++) {
+		struct etnaviv_xv_staging *staging = &priv->staging[i];
+
+		etnaviv_batch_wait_fence(etnaviv, &staging->fence);
+
+		if (staging->bo) {
+			etna_bo_del(etnaviv->conn, staging->bo, NULL);
+			staging->bo = NULL;
+			staging->ptr = NULL;
+			staging->size = 0;
+		}
+	}
+}
+
+static void etnaviv_xv_retire_stage1(struct etnaviv_fence_head *fh,
+	struct etnaviv_fence *f)
+{
+}
+
+/*
+ * Get a stage 1 buffer of at least 'size' bytes from the pool shared
+ * by all ports.  Prefer a buffer which the GPU has finished with, so
+ * that this frame's vertical blit can overlap the previous frame's
+ * horizontal blit, whichever port it was for.
+ */
+static struct etnaviv_xv_stage1 *etnaviv_xv_get_stage1(ScrnInfoPtr pScrn,
 	struct etnaviv_xv_priv *priv, size_t size)
 {
+	struct etnaviv_xv_stage1_pool *pool = priv->stage1_pool;
 	struct etnaviv *etnaviv = priv->etnaviv;
+	struct etnaviv_xv_stage1 *s1, *idle = NULL, *unused = NULL;
+	struct etnaviv_xv_stage1 *fenced = NULL;
+	unsigned i;
 
-	if (priv->stage1_bo)
-		etna_bo_del(etnaviv->conn, priv->stage1_bo, NULL);
+	if (!priv->stage1_user) {
+		priv->stage1_user = TRUE;
+		pool->users++;
+	}
 
-	/*
-	 * We don't need this bo mapped into this process at all, but
-	 * etnaviv and galcore gives us no option.
-	 */
-	priv->stage1_bo = etna_bo_new(etnaviv->conn, size,
-				      DRM_ETNA_GEM_TYPE_BMP |
-				      DRM_ETNA_GEM_CACHE_WBACK);
-	if (!priv->stage1_bo) {
+	/* Size all buffers for the largest output */
+	if (pool->size < size)
+		pool->size = size;
+
+	for (i = 0; i < XV_STAGE1_BUFS; i++) {
+		s1 = &pool->buf[i];
+
+		if (s1->busy)
+			continue;
+
+		if (!s1->bo) {
+			if (!unused)
+				unused = s1;
+		} else if (s1->fence.state == B_NONE) {
+			if (!idle)
+				idle = s1;
+		} else if (!fenced) {
+			fenced = s1;
+		}
+	}
+
+	s1 = idle ? idle : unused ? unused : fenced;
+	if (!s1) {
 		xf86DrvMsg(pScrn->scrnIndex, X_ERROR,
-			   "etnaviv Xv: etna_bo_new(size=%zu) failed\n", size);
-		priv->stage1_size = 0;
-		return FALSE;
+			   "etnaviv Xv: no free stage 1 buffers\n");
+		return NULL;
 	}
 
-	priv->stage1_size = size;
-	return TRUE;
+	/* Wait for the GPU to finish with the previous frame */
+	etnaviv_batch_wait_fence(etnaviv, &s1->fence);
+
+	if (s1->size < pool->size) {
+		if (s1->bo)
+			etna_bo_del(etnaviv->conn, s1->bo, NULL);
+
+		/*
+		 * We don't need this bo mapped into this process at all,
+		 * but etnaviv and galcore gives us no option.
+		 */
+		s1->size = 0;
+		s1->bo = etna_bo_new(etnaviv->conn, pool->size,
+				     DRM_ETNA_GEM_TYPE_BMP |
+				     DRM_ETNA_GEM_CACHE_WBACK);
+		if (!s1->bo) {
+			xf86DrvMsg(pScrn->scrnIndex, X_ERROR,
+				   "etnaviv Xv: etna_bo_new(size=%zu) failed\n",
+				   pool->size);
+			return NULL;
+		}
+
+		s1->size = pool->size;
+	}
+
+	return s1;
 }
 
+/* Return a stage 1 buffer to the pool after its last GPU operation */
+static void etnaviv_xv_put_stage1(struct etnaviv *etnaviv,
+	struct etnaviv_xv_stage1 *s1)
+{
+	if (s1) {
+		s1->busy = FALSE;
+		etnaviv_fence_add(&etnaviv->fence_head, &s1->fence);
+	}
+}
+
+/* Free the stage 1 buffers once the last port using them has stopped */
 static void etnaviv_del_stage1(struct etnaviv_xv_priv *priv)
 {
+	struct etnaviv_xv_stage1_pool *pool = priv->stage1_pool;
 	struct etnaviv *etnaviv = priv->etnaviv;
+	unsigned i;
+
+	if (!priv->stage1_user)
+		return;
 
-	if (priv->stage1_bo) {
-		etna_bo_del(etnaviv->conn, priv->stage1_bo, NULL);
-		priv->stage1_bo = NULL;
-		priv->stage1_size = 0;
+	priv->stage1_user = FALSE;
+	if (--pool->users)
+		return;
+
+	for (i = 0; i < XV_STAGE1_BUFS; i++) {
+		struct etnaviv_xv_stage1 *s1 = &pool->buf[i];
+
+		etnaviv_batch_wait_fence(etnaviv, &s1->fence);
+
+		if (s1->bo) {
+			etna_bo_del(etnaviv->conn, s1->bo, NULL);
+			s1->bo = NULL;
+			s1->size = 0;
+		}
+	}
+
+	pool->size = 0;
+}
+
+static void etnaviv_xv_final_blit(struct etnaviv *etnaviv,
+	struct etnaviv_vr_op *op, const BoxRec *dst, uint32_t x1, uint32_t y1,
+	RegionPtr clip)
+{
+	etnaviv_batch_vr_op(etnaviv, op, dst, x1, y1, RegionRects(clip),
+			    RegionNumRects(clip));
+	etnaviv_flush(etnaviv);
+}
+
+/*
+ * Perform (or with blit false, discard) the final stage of a frame
+ * which was deferred to the next vblank.
+ */
+static void etnaviv_xv_run_pending(struct etnaviv_xv_priv *priv, Bool blit)
+{
+	struct etnaviv_xv_pending *p = &priv->pending;
+	struct etnaviv *etnaviv = priv->etnaviv;
+	struct etnaviv_pixmap *vPix, *vSrc;
+	DrawablePtr drawable;
+
+	if (!p->event)
+		return;
+
+	/* The event may still be queued; it will free itself */
+	p->event->priv = NULL;
+	p->event = NULL;
+
+	if (p->src_pixmap) {
+		vSrc = etnaviv_get_pixmap_priv(p->src_pixmap);
+		if (!vSrc || !etnaviv_map_gpu(etnaviv, vSrc, GPU_ACCESS_RO))
+			blit = FALSE;
+		p->op.src.pixmap = vSrc;
+	}
+
+	vPix = etnaviv_get_pixmap_priv(p->pixmap);
+	if (blit && vPix && etnaviv_map_gpu(etnaviv, vPix, GPU_ACCESS_RW)) {
+		etnaviv_xv_filter(priv, p->op.h_scale);
+
+		p->op.dst.pixmap = vPix;
+		etnaviv_xv_final_blit(etnaviv, &p->op, &p->dst, p->x1, p->y1,
+				      &p->clip);
+
+		if (dixLookupDrawable(&drawable, p->drawable, serverClient,
+				      M_ANY, DixWriteAccess) == Success)
+			DamageDamageRegion(drawable, &p->clip);
+	}
+
+	etnaviv_xv_release_src(etnaviv, p->unode, p->staging);
+	etnaviv_xv_put_stage1(etnaviv, p->stage1);
+	p->stage1 = NULL;
+	RegionUninit(&p->clip);
+	p->pixmap->drawable.pScreen->DestroyPixmap(p->pixmap);
+	p->pixmap = NULL;
+	if (p->src_pixmap) {
+		p->src_pixmap->drawable.pScreen->DestroyPixmap(p->src_pixmap);
+		p->src_pixmap = NULL;
+	}
+}
+
+static void etnaviv_xv_vblank_handler(struct common_drm_event *base,
+	uint64_t msc, unsigned int tv_sec, unsigned int tv_usec)
+{
+	struct etnaviv_xv_vblank *event;
+	struct etnaviv_xv_priv *priv;
+
+	event = container_of(base, struct etnaviv_xv_vblank, base);
+	priv = event->priv;
+
+	if (priv) {
+		etnaviv_xv_run_pending(priv, TRUE);
+		etnaviv_commit(priv->etnaviv, FALSE);
+	}
+
+	free(event);
+}
+
+/*
+ * Queue the final stage of a frame to be performed at the next vblank,
+ * rather than blocking the server until then.  The source of the final
+ * stage remains owned by the pending blit until it has been issued.
+ */
+static Bool etnaviv_xv_defer_blit(ScrnInfoPtr pScrn,
+	struct etnaviv_xv_priv *priv, xf86CrtcPtr crtc,
+	const struct etnaviv_vr_op *op, const BoxRec *dst, uint32_t x1,
+	uint32_t y1, RegionPtr clip, DrawablePtr drawable, PixmapPtr src_pixmap,
+	struct etnaviv_usermem_node *unode, struct etnaviv_xv_staging *staging,
+	struct etnaviv_xv_stage1 *stage1)
+{
+	struct etnaviv_xv_pending *p = &priv->pending;
+	struct etnaviv_xv_vblank *event;
+	uint64_t ust, msc;
+
+	if (common_drm_get_msc(crtc, &ust, &msc))
+		return FALSE;
+
+	event = calloc(1, sizeof(*event));
+	if (!event)
+		return FALSE;
+
+	event->base.crtc = crtc;
+	event->base.handler = etnaviv_xv_vblank_handler;
+	event->priv = priv;
+
+	msc += 1;
+	if (common_drm_queue_msc_event(pScrn, crtc, &msc, __FUNCTION__,
+				       FALSE, &event->base)) {
+		free(event);
+		return FALSE;
 	}
+
+	p->event = event;
+	p->op = *op;
+	if (op->src_pitches) {
+		memcpy(p->pitches, op->src_pitches, sizeof(p->pitches));
+		memcpy(p->offsets, op->src_offsets, sizeof(p->offsets));
+		p->op.src_pitches = p->pitches;
+		p->op.src_offsets = p->offsets;
+	}
+	p->dst = *dst;
+	p->x1 = x1;
+	p->y1 = y1;
+	RegionNull(&p->clip);
+	RegionCopy(&p->clip, clip);
+	p->pixmap = drawable_pixmap(drawable);
+	p->pixmap->refcnt++;
+	/* An XVPX source pixmap must live until the blit is issued */
+	p->src_pixmap = op->src.pixmap ? src_pixmap : NULL;
+	if (p->src_pixmap)
+		p->src_pixmap->refcnt++;
+	p->drawable = drawable->id;
+	p->unode = unode;
+	p->staging = staging;
+	p->stage1 = stage1;
+	if (stage1)
+		stage1->busy = TRUE;
+
+	return TRUE;
 }
 
 static void etnaviv_StopVideo(ScrnInfoPtr pScrn, pointer data, Bool shutdown)
 {
 	struct etnaviv_xv_priv *priv = data;
 
+	etnaviv_xv_run_pending(priv, FALSE);
+
 	if (shutdown) {
 		etnaviv_del_stage1(priv);
+		etnaviv_xv_del_staging(priv);
 		priv->fmt = NULL;
 	}
 }
 
+/*
+ * The clip of a window with a deferred blit has changed: the clip and
+ * destination recorded when the frame was queued are now stale.  Follow
+ * the window if it moved, and only paint what remains visible of it.
+ */
+static void etnaviv_ClipNotify(ScrnInfoPtr pScrn, pointer data,
+	WindowPtr pWin, int dx, int dy)
+{
+	struct etnaviv_xv_priv *priv = data;
+	struct etnaviv_xv_pending *p = &priv->pending;
+	xPoint dst_offset;
+
+	if (!p->event || p->drawable != pWin->drawable.id)
+		return;
+
+	/* Redirection changed the window's pixmap: drop the blit */
+	if (!pWin->viewable ||
+	    drawable_pixmap_offset(&pWin->drawable, &dst_offset) != p->pixmap) {
+		etnaviv_xv_run_pending(priv, FALSE);
+		return;
+	}
+
+	p->op.dst.offset = dst_offset;
+
+	if (dx || dy) {
+		p->dst.x1 += dx;
+		p->dst.y1 += dy;
+		p->dst.x2 += dx;
+		p->dst.y2 += dy;
+		RegionTranslate(&p->clip, dx, dy);
+	}
+
+	RegionIntersect(&p->clip, &p->clip, &pWin->clipList);
+	if (!RegionNotEmpty(&p->clip))
+		etnaviv_xv_run_pending(priv, FALSE);
+}
+
 static int etnaviv_SetPortAttribute(ScrnInfoPtr pScrn, Atom attribute,
 	INT32 value, pointer data)
 {
@@ -463,17 +1020,28 @@ static int etnaviv_PutImage(ScrnInfoPtr pScrn,
 {
 	struct etnaviv_xv_priv *priv = data;
 	struct etnaviv *etnaviv = priv->etnaviv;
+	struct etnaviv_usermem_node *unode = NULL;
+	struct etnaviv_xv_staging *staging = NULL;
+	struct etnaviv_xv_stage1 *stage1 = NULL;
 	struct etnaviv_vr_op op;
-	struct etnaviv_pixmap *vPix;
+	struct etnaviv_pixmap *vPix, *vSrc = NULL;
+	uint32_t field_pitches[3], field_offsets[3];
+	PixmapPtr src_pixmap = NULL;
 	struct etna_bo *usr;
 	drmVBlank vbl;
 	xf86CrtcPtr crtc;
 	BoxRec dst;
 	xPoint dst_offset;
 	INT32 x1, x2, y1, y2;
-	Bool is_xvbo = id == FOURCC_XVBO;
+	Bool is_xvbo = id == FOURCC_XVBO || id == FOURCC_XVPX;
+	Bool is_xvpx = id == FOURCC_XVPX;
+	Bool pipelined = priv->props[attr_pipelined];
+	int deinterlace = priv->props[attr_deinterlace];
 	int s_w, s_h, xoff;
 
+	/* Complete the previous frame if it is still waiting for vblank */
+	etnaviv_xv_run_pending(priv, TRUE);
+
 	box_init(&dst, drw_x, drw_y, drw_w, drw_h);
 
 	x1 = src_x;
@@ -516,12 +1084,38 @@ static int etnaviv_PutImage(ScrnInfoPtr pScrn,
 		return BadAlloc;
 
 	/* Read the last vblank time */
-	if (crtc) {
+	if (crtc && !pipelined) {
 		if (common_drm_vblank_get(pScrn, crtc, &vbl, __FUNCTION__))
 			crtc = NULL;
 	}
 
-	if (is_xvbo) {
+	if (is_xvpx) {
+		XID pixmap_id = ((uint32_t *)buf)[1];
+		int ret;
+
+		/*
+		 * The buffer was imported when the client created the
+		 * pixmap via DRI3, so all we need to do is look it up.
+		 */
+		ret = xvpx_lookup_pixmap(&src_pixmap, pixmap_id);
+		if (ret != Success)
+			return ret;
+
+		vSrc = etnaviv_get_pixmap_priv(src_pixmap);
+		if (!xvpx_pixmap_layout_ok(src_pixmap, &priv->fmt->xv_image,
+					   priv->pitches[0]) ||
+		    (vSrc && (vSrc->pitch != priv->pitches[0] ||
+			      vSrc->format.tile)))
+			return BadMatch;
+
+		if (!vSrc || !vSrc->etna_bo ||
+		    etna_bo_size(vSrc->etna_bo) < priv->size ||
+		    !etnaviv_map_gpu(etnaviv, vSrc, GPU_ACCESS_RO))
+			return BadAlloc;
+
+		usr = vSrc->etna_bo;
+		xoff = 0;
+	} else if (is_xvbo) {
 		uint32_t name = ((uint32_t *)buf)[1];
 
 		usr = etna_bo_from_name(etnaviv->conn, name);
@@ -533,6 +1127,23 @@ static int etnaviv_PutImage(ScrnInfoPtr pScrn,
 			return BadAlloc;
 		}
 
+		xoff = 0;
+	} else if (pipelined) {
+		/*
+		 * The image is either part of the client's request, or a
+		 * SHM segment which the client reuses once the server
+		 * sends ShmCompletion on our return.  Either is only
+		 * valid until we return, so take a copy of it.
+		 */
+		staging = etnaviv_xv_get_staging(pScrn, priv);
+		if (!staging)
+			return BadAlloc;
+
+		etna_bo_cpu_prep(staging->bo, NULL, DRM_ETNA_PREP_WRITE);
+		memcpy(staging->ptr, buf, priv->size);
+		etna_bo_cpu_fini(staging->bo);
+
+		usr = staging->bo;
 		xoff = 0;
 	} else {
 		/* The GPU alignment offset of the buffer. */
@@ -546,13 +1157,54 @@ static int etnaviv_PutImage(ScrnInfoPtr pScrn,
 		xoff = (xoff >> 1) << 16;
 	}
 
+	/* Other sources are freed once the GPU has finished with them */
+	if (!staging && !vSrc) {
+		unode = calloc(1, sizeof(*unode));
+		if (!unode) {
+			etna_bo_del(etnaviv->conn, usr, NULL);
+			return BadAlloc;
+		}
+		unode->bo = usr;
+	}
+
 	op.src = INIT_BLIT_BO(usr, 0, priv->source_format, ZERO_OFFSET);
+	op.src.pixmap = vSrc;
 	op.src_pitches = priv->pitches;
 	op.src_offsets = priv->offsets;
 	box_init(&op.src_bounds, xoff >> 16, 0, width, height);
 
-	etna_set_state_multi(etnaviv->ctx, VIVS_DE_FILTER_KERNEL(0), KERNEL_STATE_SZ,
-			     xv_filter_kernel);
+	if (deinterlace == XV_DEINTERLACE_BOB_TOP ||
+	    deinterlace == XV_DEINTERLACE_BOB_BOTTOM) {
+		INT32 field = deinterlace == XV_DEINTERLACE_BOB_BOTTOM;
+		unsigned i;
+
+		/*
+		 * Read only the lines of one field by doubling the
+		 * pitch of each plane, starting on the field's first
+		 * line.  The source rectangle becomes field lines.
+		 * An odd height gives the top field the extra line.
+		 */
+		for (i = 0; i < 3; i++) {
+			field_pitches[i] = priv->pitches[i] * 2;
+			field_offsets[i] = priv->offsets[i] +
+					   field * priv->pitches[i];
+		}
+		op.src_pitches = field_pitches;
+		op.src_offsets = field_offsets;
+		op.src_bounds.y2 = (height + 1 - field) / 2;
+
+		/*
+		 * The top field lies half a field line above the bottom
+		 * field, so sample it half a field line further down to
+		 * keep both fields at the same position on screen.
+		 */
+		y1 /= 2;
+		y2 /= 2;
+		if (!field) {
+			y1 += 1 << 15;
+			y2 += 1 << 15;
+		}
+	}
 
 	/*
 	 * The resulting width/height of the source/destination
@@ -563,16 +1215,18 @@ static int etnaviv_PutImage(ScrnInfoPtr pScrn,
 	drw_w = box_width(&dst);
 	drw_h = box_height(&dst);
 
-	/* Check whether we need to scale in the vertical direction first. */
-	if (s_h != drw_h << 16) {
+	/*
+	 * Check whether we need to scale in the vertical direction
+	 * first.  Blend deinterlacing is performed by this stage.
+	 */
+	if (s_h != drw_h << 16 || deinterlace == XV_DEINTERLACE_BLEND) {
 		size_t stage1_size = priv->stage1_pitch;
 		BoxRec box;
 
 		stage1_size *= drw_h;
 
-		/* Check whether we need to reallocate the temporary bo */
-		if (stage1_size > priv->stage1_size &&
-		    !etnaviv_realloc_stage1(pScrn, priv, stage1_size))
+		stage1 = etnaviv_xv_get_stage1(pScrn, priv, stage1_size);
+		if (!stage1)
 			goto bad_alloc;
 
 		box_init(&box, 0, 0, width, drw_h);
@@ -584,12 +1238,18 @@ static int etnaviv_PutImage(ScrnInfoPtr pScrn,
 		 */
 		op.h_scale = 1 << 16;
 		op.v_scale = s_h / drw_h;
-		op.dst = INIT_BLIT_BO(priv->stage1_bo, priv->stage1_pitch,
+		op.dst = INIT_BLIT_BO(stage1->bo, priv->stage1_pitch,
 				      priv->stage1_format, ZERO_OFFSET);
 		op.cmd = VIVS_DE_DEST_CONFIG_COMMAND_VER_FILTER_BLT;
 		op.vr_op = VIVS_DE_VR_CONFIG_START_VERTICAL_BLIT;
 
-		etnaviv_vr_op(etnaviv, &op, &box, xoff, y1, &box, 1);
+		/* Downscaling by two or more blends the lines anyway */
+		if (deinterlace == XV_DEINTERLACE_BLEND &&
+		    op.v_scale < 2 << 16)
+			etnaviv_set_filter_kernel(etnaviv, xv_filter_blend);
+		else
+			etnaviv_xv_filter(priv, op.v_scale);
+		etnaviv_batch_vr_op(etnaviv, &op, &box, xoff, y1, &box, 1);
 		/* GC320 and GC600 do not seem to need a flush here */
 
 		/* Set the source for the next stage */
@@ -610,38 +1270,53 @@ static int etnaviv_PutImage(ScrnInfoPtr pScrn,
 	}
 
 	op.dst = INIT_BLIT_BO(vPix->etna_bo, vPix->pitch, vPix->format, dst_offset);
+	op.dst.pixmap = vPix;
 	op.h_scale = s_w / drw_w;
 	op.v_scale = 1 << 16;
 	op.cmd = VIVS_DE_DEST_CONFIG_COMMAND_HOR_FILTER_BLT;
 	op.vr_op = VIVS_DE_VR_CONFIG_START_HORIZONTAL_BLIT;
 
+	/*
+	 * In pipelined mode, the horizontal filter blit is performed
+	 * from the vblank event rather than waiting for it here.  The
+	 * source is never client memory in this mode.
+	 */
+	if (crtc && pipelined && priv->props[attr_sync_to_vblank] &&
+	    etnaviv_xv_defer_blit(pScrn, priv, crtc, &op, &dst, x1, y1,
+				  clipBoxes, drawable, src_pixmap, unode,
+				  staging, stage1))
+		return Success;
+
 	/* Perform horizontal filter blt */
-	etnaviv_vr_op(etnaviv, &op, &dst, x1, y1, RegionRects(clipBoxes),
-		      RegionNumRects(clipBoxes));
-	etnaviv_flush(etnaviv);
+	etnaviv_xv_filter(priv, op.h_scale);
+	etnaviv_xv_final_blit(etnaviv, &op, &dst, x1, y1, clipBoxes);
+	etnaviv_xv_release_src(etnaviv, unode, staging);
+	etnaviv_xv_put_stage1(etnaviv, stage1);
+
+	if (!pipelined) {
+		/* Wait for vsync */
+		if (crtc && priv->props[attr_sync_to_vblank]) {
+			vbl.request.sequence = vbl.reply.sequence + 1;
+			common_drm_vblank_wait(pScrn, crtc, &vbl, __FUNCTION__,
+					       FALSE);
+		}
 
-	/* Wait for vsync */
-	if (crtc && priv->props[attr_sync_to_vblank]) {
-		vbl.request.sequence = vbl.reply.sequence + 1;
-		common_drm_vblank_wait(pScrn, crtc, &vbl, __FUNCTION__, FALSE);
+		/*
+		 * Wait for the GPU to finish rendering, which also
+		 * releases the source buffer.
+		 */
+		etnaviv_commit(etnaviv, TRUE);
 	}
 
-	/*
-	 * It would be nice not to wait for the GPU to finish rendering
-	 * here, but it seems we can't avoid it.  In theory, 'sync'
-	 * would tell us whether we can, but in the case of non-shmem,
-	 * that is always false, and the passed buffer is part of the
-	 * client specific request buffer on the server.
-	 */
-	etna_finish(etnaviv->ctx);
-
-	etna_bo_del(etnaviv->conn, usr, NULL);
 	DamageDamageRegion(drawable, clipBoxes);
 
 	return Success;
 
  bad_alloc:
-	etna_bo_del(etnaviv->conn, usr, NULL);
+	if (unode) {
+		etna_bo_del(etnaviv->conn, usr, NULL);
+		free(unode);
+	}
 
 	return BadAlloc;
 }
@@ -698,84 +1373,6 @@ static int etnaviv_QueryImageAttributes(ScrnInfoPtr pScrn, int id,
 	return ret;
 }
 
-static inline float sinc(float x)
-{
-	return x != 0.0 ? sinf(x) / x : 1.0;
-}
-
-/*
- * Some interesting observations of the kernel.  According to the etnaviv
- * rnndb files:
- *  - there are 128 states which hold the kernel.
- *  - each entry contains 9 coefficients (one for each filter tap).
- *  - the entries are indexed by 5 bits from the fractional coordinate
- *    (which makes 32 entries.)
- *
- * As the kernel table is symmetrical around the centre of the fractional
- * coordinate, only half of the entries need to be stored.  In other words,
- * these pairs of indices should be the same:
- *
- *  00=31 01=30 02=29 03=28 04=27 05=26 06=25 07=24
- *  08=23 09=22 10=21 11=20 12=19 13=18 14=17 15=16
- *
- * This means that there are only 16 entries.  However, etnaviv
- * documentation says 17 are required.  What's the additional entry?
- *
- * The next issue is that the filter code always produces zero for the
- * ninth filter tap.  If this is always zero, what's the point of having
- * hardware deal with nine filter taps?  This makes no sense to me.
- */
-static void etnaviv_init_filter_kernel(void)
-{
-	unsigned row, idx, i;
-	int16_t kernel_val[KERNEL_STATE_SZ * 2];
-	float row_ofs = 0.5;
-	float radius = 4.0;
-
-	/* Compute lanczos filter kernel */
-	for (row = i = 0; row < KERNEL_ROWS; row++) {
-		float kernel[KERNEL_INDICES] = { 0.0 };
-		float sum = 0.0;
-
-		for (idx = 0; idx < KERNEL_INDICES; idx++) {
-			float x = idx - 4.0 + row_ofs;
-
-			if (fabs(x) <= radius)
-				kernel[idx] = sinc(M_PI * x) *
-					      sinc(M_PI * x / radius);
-
-			sum += kernel[idx];
-		}
-
-		/* normalise the row */
-		if (sum)
-			for (idx = 0; idx < KERNEL_INDICES; idx++)
-				kernel[idx] /= sum;
-
-		/* convert to 1.14 format */
-		for (idx = 0; idx < KERNEL_INDICES; idx++) {
-			int val = kernel[idx] * (float)(1 << 14);
-
-			if (val < -0x8000)
-				val = -0x8000;
-			else if (val > 0x7fff)
-				val = 0x7fff;
-
-			kernel_val[i++] = val;
-		}
-
-		row_ofs -= 1.0 / ((KERNEL_ROWS - 1) * 2);
-	}
-
-	kernel_val[KERNEL_SIZE] = 0;
-
-	/* Now convert the kernel values into state values */
-	for (i = 0; i < KERNEL_STATE_SZ * 2; i += 2)
-		xv_filter_kernel[i / 2] =
-			VIVS_DE_FILTER_KERNEL_COEFFICIENT0(kernel_val[i]) |
-			VIVS_DE_FILTER_KERNEL_COEFFICIENT1(kernel_val[i + 1]);
-}
-
 static Bool etnaviv_xv_CloseScreen(CLOSE_SCREEN_ARGS_DECL)
 {
 	ScrnInfoPtr pScrn = xf86ScreenToScrn(pScreen);
@@ -787,6 +1384,7 @@ static Bool etnaviv_xv_CloseScreen(CLOSE_SCREEN_ARGS_DECL)
 		for (i = 0; i < etnaviv->xv_ports; i++)
 			etnaviv_StopVideo(pScrn, &priv[i], TRUE);
 
+		free(priv->stage1_pool);
 		free(priv);
 	}
 
@@ -803,8 +1401,9 @@ XF86VideoAdaptorPtr etnaviv_xv_init(ScreenPtr pScreen, unsigned int *caps)
 	XF86VideoAdaptorPtr p;
 	XF86ImageRec *images;
 	DevUnion *devUnions;
+	struct etnaviv_xv_stage1_pool *pool;
 	Bool has_yuy2;
-	unsigned nports = 16, i, num_images;
+	unsigned nports = XV_NR_PORTS, i, j, num_images;
 
 #ifdef HAVE_DRI2
 	if (etnaviv->dri2_enabled) {
@@ -815,7 +1414,13 @@ XF86VideoAdaptorPtr etnaviv_xv_init(ScreenPtr pScreen, unsigned int *caps)
 	}
 #endif
 
-	etnaviv_init_filter_kernel();
+	etnaviv_init_filter_kernel(xv_filter_bilinear, FILTER_BILINEAR);
+	etnaviv_init_scaled_filter_kernel(xv_filter_blend, FILTER_BILINEAR,
+					  2.0);
+	for (i = 0; i < XV_FILTER_BUCKETS; i++)
+		etnaviv_init_scaled_filter_kernel(xv_filter_scaled[i],
+						  FILTER_LANCZOS,
+						  xv_filter_scales[i]);
 
 	etnaviv_xv_attributes[attr_pipe].max_value =
 		XF86_CRTC_CONFIG_PTR(pScrn)->num_crtc - 1;
@@ -827,7 +1432,9 @@ XF86VideoAdaptorPtr etnaviv_xv_init(ScreenPtr pScreen, unsigned int *caps)
 	devUnions = calloc(nports, sizeof(*devUnions));
 	priv = calloc(nports, sizeof(*priv));
 	images = calloc(ARRAY_SIZE(etnaviv_image_formats), sizeof(*images));
-	if (!p || !devUnions || !priv || !images) {
+	pool = calloc(1, sizeof(*pool));
+	if (!p || !devUnions || !priv || !images || !pool) {
+		free(pool);
 		free(images);
 		free(priv);
 		free(devUnions);
@@ -850,6 +1457,13 @@ XF86VideoAdaptorPtr etnaviv_xv_init(ScreenPtr pScreen, unsigned int *caps)
 				continue;
 		}
 
+		if (fmt->xv_image.id == FOURCC_XVPX) {
+#ifdef HAVE_DRI3
+			if (!etnaviv->dri3_enabled)
+#endif
+				continue;
+		}
+
 		images[num_images++] = fmt->xv_image;
 	}
 
@@ -867,6 +1481,7 @@ XF86VideoAdaptorPtr etnaviv_xv_init(ScreenPtr pScreen, unsigned int *caps)
 	p->nImages = num_images;
 	p->pImages = images;
 	p->StopVideo = etnaviv_StopVideo;
+	p->ClipNotify = etnaviv_ClipNotify;
 	p->SetPortAttribute = etnaviv_SetPortAttribute;
 	p->GetPortAttribute = etnaviv_GetPortAttribute;
 	p->QueryBestSize = etnaviv_QueryBestSize;
@@ -876,9 +1491,18 @@ XF86VideoAdaptorPtr etnaviv_xv_init(ScreenPtr pScreen, unsigned int *caps)
 	for (i = 0; i < nports; i++) {
 		priv[i].etnaviv = etnaviv;
 		priv[i].props[attr_sync_to_vblank] = 1;
+		priv[i].props[attr_pipelined] = 1;
+		priv[i].props[attr_filter_quality] = XV_FILTER_ADAPTIVE;
+		priv[i].stage1_pool = pool;
+		for (j = 0; j < XV_STAGING_BUFS; j++)
+			priv[i].staging[j].fence.retire =
+				etnaviv_xv_retire_staging;
 		p->pPortPrivates[i].ptr = (pointer) &priv[i];
 	}
 
+	for (i = 0; i < XV_STAGE1_BUFS; i++)
+		pool->buf[i].fence.retire = etnaviv_xv_retire_stage1;
+
 	/* This feature bit is a guess for the GC supporting YUY2 target... */
 	has_yuy2 = VIV_FEATURE(etnaviv->conn, chipMinorFeatures0, 2DPE20);
 	xf86DrvMsg(pScrn->scrnIndex, X_INFO,
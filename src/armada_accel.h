@@ -34,6 +34,7 @@ struct armada_accel_ops {
 			       void *user_data);
 	XF86VideoAdaptorPtr (*xv_init)(ScreenPtr, unsigned int *);
 	int (*export_name)(ScreenPtr, uint32_t);
+	int (*export_dmabuf)(ScreenPtr, PixmapPtr);
 };
 
 Bool accel_module_init(const struct armada_accel_ops **);
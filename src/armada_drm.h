@@ -39,6 +39,7 @@ enum {
 	OPTION_XV_ACCEL,
 	OPTION_XV_PREFEROVL,
 	OPTION_XV_DISPRIMARY,
+	OPTION_XV_ATOMIC,
 	OPTION_USE_GPU,
 	OPTION_USE_KMS_BO,
 	OPTION_ACCEL_MODULE,
@@ -24,9 +24,13 @@
 #include <X11/extensions/Xv.h>
 #include <X11/Xatom.h>
 
+#include "resource.h"
+
 #include "armada_ioctl.h"
 #include "boxutil.h"
+#include "compat-drm.h"
 #include "fourcc.h"
+#include "wc_copy.h"
 #include "xv_attribute.h"
 #include "xv_image_format.h"
 #include "xvbo.h"
@@ -36,6 +40,7 @@ typedef uint32_t phys_t;
 #define INVALID_PHYS	(~(phys_t)0)
 
 #define NR_BUFS	3
+#define NR_PIX_BUFS	8
 
 enum armada_drm_properties {
 	PROP_DRM_SATURATION,
@@ -54,22 +59,62 @@ static const char *armada_drm_property_names[NR_DRM_PROPS] = {
 	[PROP_DRM_COLORKEY] = "colorkey",
 };
 
+/* Standard plane properties used for atomic updates */
+enum armada_drm_atomic_properties {
+	PROP_ATOMIC_FB_ID,
+	PROP_ATOMIC_CRTC_ID,
+	PROP_ATOMIC_SRC_X,
+	PROP_ATOMIC_SRC_Y,
+	PROP_ATOMIC_SRC_W,
+	PROP_ATOMIC_SRC_H,
+	PROP_ATOMIC_CRTC_X,
+	PROP_ATOMIC_CRTC_Y,
+	PROP_ATOMIC_CRTC_W,
+	PROP_ATOMIC_CRTC_H,
+	NR_ATOMIC_PROPS
+};
+
+static const char *armada_drm_atomic_property_names[NR_ATOMIC_PROPS] = {
+	[PROP_ATOMIC_FB_ID] = "FB_ID",
+	[PROP_ATOMIC_CRTC_ID] = "CRTC_ID",
+	[PROP_ATOMIC_SRC_X] = "SRC_X",
+	[PROP_ATOMIC_SRC_Y] = "SRC_Y",
+	[PROP_ATOMIC_SRC_W] = "SRC_W",
+	[PROP_ATOMIC_SRC_H] = "SRC_H",
+	[PROP_ATOMIC_CRTC_X] = "CRTC_X",
+	[PROP_ATOMIC_CRTC_Y] = "CRTC_Y",
+	[PROP_ATOMIC_CRTC_W] = "CRTC_W",
+	[PROP_ATOMIC_CRTC_H] = "CRTC_H",
+};
+
 struct drm_xv_prop {
 	uint32_t prop_id;
 	uint64_t value;
 };
 
+struct drm_xv;
+
+/* An atomic overlay update waiting to be displayed */
+struct drm_xv_flip {
+	struct common_drm_event base;
+	struct drm_xv *drmxv;
+	uint32_t fb_id;
+};
+
 struct drm_xv {
 	int fd;
+	struct common_drm_info *drm;
 	struct drm_armada_bufmgr *bufmgr;
 
 	/* Common information */
 	xf86CrtcPtr desired_crtc;
 	Bool has_xvbo;
+	Bool has_xvpx;
 	Bool is_xvbo;
 	Bool autopaint_colorkey;
 	Bool has_primary;
 	Bool primary_obscured;
+	Bool has_atomic;
 
 	/* Cached image information */
 	RegionRec clipBoxes;
@@ -79,6 +124,8 @@ struct drm_xv {
 	uint32_t image_size;
 	uint32_t pitches[3];
 	uint32_t offsets[3];
+	uint32_t plane_sizes[3];	/* excluding alignment padding */
+	unsigned num_planes;
 
 	unsigned bo_idx;
 	struct {
@@ -88,6 +135,22 @@ struct drm_xv {
 
 	struct drm_armada_bo *last_bo;
 
+	/*
+	 * The framebuffer being scanned out, and any atomic update
+	 * queued to replace it.  A replaced XVBO framebuffer is only
+	 * removed once it is no longer being scanned out.
+	 */
+	uint32_t scanout_fb_id;
+	uint32_t retire_fb_id;
+	Bool flip_pending;
+	struct drm_xv_flip flip;
+
+	/* Imported XVPX pixmap buffers, most recently used first */
+	struct {
+		unsigned long serial;
+		struct drm_armada_bo *bo;
+	} pix_bufs[NR_PIX_BUFS];
+
 	int (*get_fb)(ScrnInfoPtr, struct drm_xv *, unsigned char *,
 		uint32_t *);
 	struct drm_armada_bo *(*import_name)(ScrnInfoPtr, struct drm_xv *,
@@ -101,6 +164,8 @@ struct drm_xv {
 	unsigned int num_planes;
 	drmModePlanePtr mode_planes[4];
 	struct drm_xv_prop props[NR_DRM_PROPS];
+	uint32_t atomic_props[NR_ATOMIC_PROPS];
+	Bool props_dirty;
 };
 
 enum {
@@ -117,6 +182,178 @@ enum {
 
 static struct xv_attr_data armada_drm_xv_attributes[];
 
+/*
+ * Framebuffer lifetime tracking
+ */
+static Bool armada_drm_fb_displayed(struct drm_xv *drmxv, uint32_t fb_id)
+{
+	return fb_id == drmxv->scanout_fb_id ||
+	       (drmxv->flip_pending && fb_id == drmxv->flip.fb_id);
+}
+
+/* Remove a replaced framebuffer once it is no longer being displayed */
+static void armada_drm_retire_fb(struct drm_xv *drmxv)
+{
+	if (drmxv->retire_fb_id &&
+	    !armada_drm_fb_displayed(drmxv, drmxv->retire_fb_id)) {
+		drmModeRmFB(drmxv->fd, drmxv->retire_fb_id);
+		drmxv->retire_fb_id = 0;
+	}
+}
+
+static void armada_drm_release_fb(struct drm_xv *drmxv, uint32_t fb_id)
+{
+	armada_drm_retire_fb(drmxv);
+
+	if (armada_drm_fb_displayed(drmxv, fb_id))
+		drmxv->retire_fb_id = fb_id;
+	else
+		drmModeRmFB(drmxv->fd, fb_id);
+}
+
+static void armada_drm_flip_handler(struct common_drm_event *event,
+	uint64_t msc, unsigned int tv_sec, unsigned int tv_usec)
+{
+	struct drm_xv_flip *flip = container_of(event, struct drm_xv_flip,
+						base);
+	struct drm_xv *drmxv = flip->drmxv;
+
+	drmxv->flip_pending = FALSE;
+	drmxv->scanout_fb_id = flip->fb_id;
+	armada_drm_retire_fb(drmxv);
+}
+
+/* Wait for a queued atomic update to be displayed */
+static void armada_drm_wait_flip(struct drm_xv *drmxv)
+{
+	while (drmxv->flip_pending)
+		if (drmHandleEvent(drmxv->fd, &drmxv->drm->event_context)) {
+			drmxv->flip_pending = FALSE;
+			break;
+		}
+}
+
+#ifdef HAVE_DRM_ATOMIC
+static Bool armada_drm_atomic_add(drmModeAtomicReqPtr req, uint32_t plane_id,
+	uint32_t prop_id, uint64_t value)
+{
+	return drmModeAtomicAddProperty(req, plane_id, prop_id, value) >= 0;
+}
+
+static Bool armada_drm_atomic_add_props(struct drm_xv *drmxv,
+	drmModeAtomicReqPtr req, uint32_t plane_id)
+{
+	unsigned int i;
+
+	for (i = 0; i < NR_DRM_PROPS; i++)
+		if (drmxv->props[i].prop_id &&
+		    !armada_drm_atomic_add(req, plane_id,
+					   drmxv->props[i].prop_id,
+					   drmxv->props[i].value))
+			return FALSE;
+
+	return TRUE;
+}
+
+/*
+ * Queue an atomic update of the overlay plane, which will be displayed
+ * at the next vblank.  Only one update may be outstanding at a time.
+ */
+static int armada_drm_atomic_commit(ScrnInfoPtr pScrn, struct drm_xv *drmxv,
+	drmModeAtomicReqPtr req, xf86CrtcPtr crtc, uint32_t fb_id)
+{
+	int ret;
+
+	armada_drm_wait_flip(drmxv);
+
+	drmxv->flip.base.crtc = crtc;
+	drmxv->flip.fb_id = fb_id;
+
+	ret = drmModeAtomicCommit(drmxv->fd, req,
+				  DRM_MODE_ATOMIC_NONBLOCK |
+				  DRM_MODE_PAGE_FLIP_EVENT, &drmxv->flip.base);
+
+	/*
+	 * The CRTC may still have some other update pending, such as
+	 * a DRI2 or Present page flip.  Rather than dropping the frame,
+	 * make a blocking commit, which waits for that to complete.
+	 */
+	if (ret && errno == EBUSY)
+		ret = drmModeAtomicCommit(drmxv->fd, req,
+					  DRM_MODE_PAGE_FLIP_EVENT,
+					  &drmxv->flip.base);
+	if (ret) {
+		xf86DrvMsg(pScrn->scrnIndex, X_WARNING,
+			   "[drm] Xv: atomic commit failed: %s\n",
+			   strerror(errno));
+		return BadAlloc;
+	}
+
+	drmxv->flip_pending = TRUE;
+	drmxv->props_dirty = FALSE;
+
+	return Success;
+}
+
+static int armada_drm_atomic_put(ScrnInfoPtr pScrn, struct drm_xv *drmxv,
+	xf86CrtcPtr crtc, uint32_t fb_id, uint32_t crtc_x, uint32_t crtc_y,
+	const BoxRec *dst, INT32 x1, INT32 y1, INT32 x2, INT32 y2)
+{
+	const uint32_t *p = drmxv->atomic_props;
+	uint32_t plane_id = drmxv->overlay_plane->plane_id;
+	drmModeAtomicReqPtr req;
+	int ret = BadAlloc;
+
+	req = drmModeAtomicAlloc();
+	if (!req)
+		return BadAlloc;
+
+	if (armada_drm_atomic_add(req, plane_id, p[PROP_ATOMIC_FB_ID], fb_id) &&
+	    armada_drm_atomic_add(req, plane_id, p[PROP_ATOMIC_CRTC_ID],
+				  common_crtc(crtc)->drm_id) &&
+	    armada_drm_atomic_add(req, plane_id, p[PROP_ATOMIC_SRC_X], x1) &&
+	    armada_drm_atomic_add(req, plane_id, p[PROP_ATOMIC_SRC_Y], y1) &&
+	    armada_drm_atomic_add(req, plane_id, p[PROP_ATOMIC_SRC_W],
+				  x2 - x1) &&
+	    armada_drm_atomic_add(req, plane_id, p[PROP_ATOMIC_SRC_H],
+				  y2 - y1) &&
+	    armada_drm_atomic_add(req, plane_id, p[PROP_ATOMIC_CRTC_X],
+				  crtc_x) &&
+	    armada_drm_atomic_add(req, plane_id, p[PROP_ATOMIC_CRTC_Y],
+				  crtc_y) &&
+	    armada_drm_atomic_add(req, plane_id, p[PROP_ATOMIC_CRTC_W],
+				  dst->x2 - dst->x1) &&
+	    armada_drm_atomic_add(req, plane_id, p[PROP_ATOMIC_CRTC_H],
+				  dst->y2 - dst->y1) &&
+	    (!drmxv->props_dirty ||
+	     armada_drm_atomic_add_props(drmxv, req, plane_id)))
+		ret = armada_drm_atomic_commit(pScrn, drmxv, req, crtc, fb_id);
+
+	drmModeAtomicFree(req);
+
+	return ret;
+}
+
+/* Update the colour properties of the displayed overlay plane */
+static void armada_drm_atomic_set_props(ScrnInfoPtr pScrn,
+	struct drm_xv *drmxv)
+{
+	drmModeAtomicReqPtr req;
+
+	req = drmModeAtomicAlloc();
+	if (!req)
+		return;
+
+	if (armada_drm_atomic_add_props(drmxv, req,
+					drmxv->overlay_plane->plane_id))
+		armada_drm_atomic_commit(pScrn, drmxv, req,
+					 drmxv->flip.base.crtc,
+					 drmxv->scanout_fb_id);
+
+	drmModeAtomicFree(req);
+}
+#endif
+
 /*
  * Attribute support code
  */
@@ -134,6 +371,20 @@ static int armada_drm_prop_set(ScrnInfoPtr pScrn,
 	prop->value = value;
 	prop_id = prop->prop_id;
 
+#ifdef HAVE_DRM_ATOMIC
+	/*
+	 * With atomic updates, the properties are sent along with the
+	 * next frame, or immediately if the overlay is already showing.
+	 */
+	if (drmxv->has_atomic) {
+		drmxv->props_dirty = TRUE;
+		armada_drm_wait_flip(drmxv);
+		if (drmxv->overlay_plane && drmxv->scanout_fb_id)
+			armada_drm_atomic_set_props(pScrn, drmxv);
+		return Success;
+	}
+#endif
+
 	for (i = 0; i < drmxv->num_planes; i++)
 		drmModeObjectSetProperty(drmxv->fd,
 					 drmxv->mode_planes[i]->plane_id,
@@ -400,7 +651,10 @@ static const struct xv_image_format armada_drm_formats[] = {
 		.u.drm_format = DRM_FORMAT_BGR565,
 		.xv_image = XVIMAGE_BGR565
 	}, {
-		/* This must be the last */
+		/* These must be the last */
+		.u.drm_format = 0,
+		.xv_image = XVIMAGE_XVPX
+	}, {
 		.u.drm_format = 0,
 		.xv_image = XVIMAGE_XVBO
 	},
@@ -421,36 +675,41 @@ static const struct xv_image_format *armada_drm_lookup_drmfourcc(uint32_t fmt)
 
 static int
 armada_drm_get_fmt_info(const struct xv_image_format *fmt,
-	uint32_t *pitch, uint32_t *offset, short width, short height)
+	uint32_t *pitch, uint32_t *offset, uint32_t *size, short width,
+	short height)
 {
 	const XF86ImageRec *img = &fmt->xv_image;
+	uint32_t sz[3];
 	int ret = 0;
 
-	if (img->id == FOURCC_XVBO) {
-		/* Our special XVBO format is only two uint32_t */
+	if (img->id == FOURCC_XVBO || img->id == FOURCC_XVPX) {
+		/* Our special XVBO formats are only two uint32_t */
 		pitch[0] = 2 * sizeof(uint32_t);
 		offset[0] = 0;
+		sz[0] = pitch[0];
 		ret = pitch[0];
 	} else if (img->format == XvPlanar) {
-		uint32_t size[3];
-
 		pitch[0] = width / img->horz_y_period;
 		pitch[1] = width / img->horz_u_period;
 		pitch[2] = width / img->horz_v_period;
-		size[0] = (pitch[0] * (height / img->vert_y_period) + 7) & ~7;
-		size[1] = (pitch[1] * (height / img->vert_u_period) + 7) & ~7;
-		size[2] = (pitch[2] * (height / img->vert_v_period) + 7) & ~7;
+		sz[0] = pitch[0] * (height / img->vert_y_period);
+		sz[1] = pitch[1] * (height / img->vert_u_period);
+		sz[2] = pitch[2] * (height / img->vert_v_period);
 		offset[0] = 0;
-		offset[1] = offset[0] + size[0];
-		offset[2] = offset[1] + size[1];
+		offset[1] = offset[0] + ((sz[0] + 7) & ~7);
+		offset[2] = offset[1] + ((sz[1] + 7) & ~7);
 
-		ret = size[0] + size[1] + size[2];
+		ret = offset[2] + ((sz[2] + 7) & ~7);
 	} else if (img->format == XvPacked) {
 		offset[0] = 0;
 		pitch[0] = width * ((img->bits_per_pixel + 7) / 8);
-		ret = offset[0] + pitch[0] * height;
+		sz[0] = pitch[0] * height;
+		ret = offset[0] + sz[0];
 	}
 
+	if (ret && size)
+		memcpy(size, sz, img->num_planes * sizeof(*size));
+
 	return ret;
 }
 
@@ -458,6 +717,13 @@ static void armada_drm_bufs_free(struct drm_xv *drmxv)
 {
 	unsigned i;
 
+	armada_drm_wait_flip(drmxv);
+
+	if (drmxv->retire_fb_id) {
+		drmModeRmFB(drmxv->fd, drmxv->retire_fb_id);
+		drmxv->retire_fb_id = 0;
+	}
+
 	for (i = 0; i < ARRAY_SIZE(drmxv->bufs); i++) {
 		if (drmxv->bufs[i].fb_id) {
 			if (drmxv->bufs[i].fb_id == drmxv->plane_fb_id)
@@ -476,10 +742,20 @@ static void armada_drm_bufs_free(struct drm_xv *drmxv)
 		drmxv->plane_fb_id = 0;
 	}
 
+	/* Removing the framebuffers has disabled the overlay */
+	drmxv->scanout_fb_id = 0;
+
 	if (drmxv->last_bo) {
 		drm_armada_bo_put(drmxv->last_bo);
 		drmxv->last_bo = NULL;
 	}
+
+	for (i = 0; i < ARRAY_SIZE(drmxv->pix_bufs); i++) {
+		if (drmxv->pix_bufs[i].bo) {
+			drm_armada_bo_put(drmxv->pix_bufs[i].bo);
+			drmxv->pix_bufs[i].bo = NULL;
+		}
+	}
 }
 
 static Bool
@@ -574,21 +850,9 @@ static Bool armada_drm_is_bmm(unsigned char *buf)
 }
 
 static int
-armada_drm_get_xvbo(ScrnInfoPtr pScrn, struct drm_xv *drmxv, unsigned char *buf,
-	uint32_t *id)
+armada_drm_xvbo_fbid(ScrnInfoPtr pScrn, struct drm_xv *drmxv,
+	struct drm_armada_bo *bo, uint32_t *id)
 {
-	struct drm_armada_bo *bo;
-	uint32_t name = ((uint32_t *)buf)[1];
-
-	/* Lookup the bo for the global name on the DRI2 device */
-	bo = drmxv->import_name(pScrn, drmxv, name);
-	if (!bo) {
-		xf86DrvMsg(pScrn->scrnIndex, X_ERROR,
-			   "[drm] xvbo: import of name 0x%08x failed: %s\n",
-			   name, strerror(errno));
-		return BadAlloc;
-	}
-
 	/* Is this a re-display of the previous frame? */
 	if (drmxv->last_bo == bo) {
 		drm_armada_bo_put(bo);
@@ -612,15 +876,141 @@ armada_drm_get_xvbo(ScrnInfoPtr pScrn, struct drm_xv *drmxv, unsigned char *buf,
 	return Success;
 }
 
+static int
+armada_drm_get_xvbo(ScrnInfoPtr pScrn, struct drm_xv *drmxv, unsigned char *buf,
+	uint32_t *id)
+{
+	struct drm_armada_bo *bo;
+	uint32_t name = ((uint32_t *)buf)[1];
+
+	/* Lookup the bo for the global name on the DRI2 device */
+	bo = drmxv->import_name(pScrn, drmxv, name);
+	if (!bo) {
+		xf86DrvMsg(pScrn->scrnIndex, X_ERROR,
+			   "[drm] xvbo: import of name 0x%08x failed: %s\n",
+			   name, strerror(errno));
+		return BadAlloc;
+	}
+
+	return armada_drm_xvbo_fbid(pScrn, drmxv, bo, id);
+}
+
+/*
+ * Look up the bo for a pixmap which the client created from a DMA-BUF.
+ * Each pixmap is only imported once; we identify it by its serial
+ * number, which is not reused as XIDs and pointers may be.
+ */
+static struct drm_armada_bo *
+armada_drm_import_pixmap(ScrnInfoPtr pScrn, struct drm_xv *drmxv,
+	PixmapPtr pixmap)
+{
+	ScreenPtr scrn = screenInfo.screens[pScrn->scrnIndex];
+	struct armada_drm_info *arm = GET_ARMADA_DRM_INFO(pScrn);
+	struct drm_armada_bo *bo;
+	unsigned long serial;
+	unsigned i;
+	int fd;
+
+	serial = pixmap->drawable.serialNumber;
+
+	for (i = 0; i < NR_PIX_BUFS; i++)
+		if (drmxv->pix_bufs[i].bo &&
+		    drmxv->pix_bufs[i].serial == serial)
+			break;
+
+	if (i < NR_PIX_BUFS) {
+		bo = drmxv->pix_bufs[i].bo;
+	} else {
+		fd = arm->accel_ops->export_dmabuf(scrn, pixmap);
+		if (fd == -1)
+			return NULL;
+
+		bo = drm_armada_bo_from_fd(drmxv->bufmgr, fd);
+		close(fd);
+		if (!bo)
+			return NULL;
+
+		/* Replace the least recently used import */
+		i = NR_PIX_BUFS - 1;
+		if (drmxv->pix_bufs[i].bo)
+			drm_armada_bo_put(drmxv->pix_bufs[i].bo);
+	}
+
+	memmove(&drmxv->pix_bufs[1], &drmxv->pix_bufs[0],
+		i * sizeof(drmxv->pix_bufs[0]));
+	drmxv->pix_bufs[0].serial = serial;
+	drmxv->pix_bufs[0].bo = bo;
+
+	/* The caller gets its own reference */
+	drm_armada_bo_get(bo);
+
+	return bo;
+}
+
+static int
+armada_drm_get_xvpx(ScrnInfoPtr pScrn, struct drm_xv *drmxv, unsigned char *buf,
+	uint32_t *id)
+{
+	struct drm_armada_bo *bo;
+	uint32_t xid = ((uint32_t *)buf)[1];
+	PixmapPtr pixmap;
+	int ret;
+
+	ret = xvpx_lookup_pixmap(&pixmap, xid);
+	if (ret != Success)
+		return ret;
+
+	if (!xvpx_pixmap_layout_ok(pixmap, &drmxv->plane_format->xv_image,
+				   drmxv->pitches[0]))
+		return BadMatch;
+
+	bo = armada_drm_import_pixmap(pScrn, drmxv, pixmap);
+	if (!bo) {
+		xf86DrvMsg(pScrn->scrnIndex, X_ERROR,
+			   "[drm] xvpx: import of pixmap 0x%08x failed: %s\n",
+			   xid, strerror(errno));
+		return BadAlloc;
+	}
+
+	if (bo->size < drmxv->image_size) {
+		drm_armada_bo_put(bo);
+		return BadAlloc;
+	}
+
+	return armada_drm_xvbo_fbid(pScrn, drmxv, bo, id);
+}
+
 static int
 armada_drm_get_std(ScrnInfoPtr pScrn, struct drm_xv *drmxv, unsigned char *src,
 	uint32_t *id)
 {
-	struct drm_armada_bo *bo = drmxv->bufs[drmxv->bo_idx].bo;
+	struct drm_armada_bo *bo;
+	unsigned i;
 
+	/*
+	 * Find a buffer which is neither being displayed nor queued for
+	 * display, waiting for the queued update to complete if needed.
+	 */
+	for (i = 0; i < ARRAY_SIZE(drmxv->bufs); i++) {
+		if (!armada_drm_fb_displayed(drmxv,
+					     drmxv->bufs[drmxv->bo_idx].fb_id))
+			break;
+		if (++drmxv->bo_idx >= ARRAY_SIZE(drmxv->bufs))
+			drmxv->bo_idx = 0;
+	}
+	if (i == ARRAY_SIZE(drmxv->bufs))
+		armada_drm_wait_flip(drmxv);
+
+	bo = drmxv->bufs[drmxv->bo_idx].bo;
 	if (bo) {
-		/* Copy new image data into the buffer */
-		memcpy(bo->ptr, src, drmxv->image_size);
+		/*
+		 * Copy new image data into the write-combined buffer,
+		 * skipping the alignment padding between the planes.
+		 */
+		for (i = 0; i < drmxv->num_planes; i++)
+			wc_copy((char *)bo->ptr + drmxv->offsets[i],
+				src + drmxv->offsets[i],
+				drmxv->plane_sizes[i]);
 
 		/* Return this buffer's framebuffer id */
 		*id = drmxv->bufs[drmxv->bo_idx].fb_id;
@@ -679,7 +1069,8 @@ armada_drm_Xv_QueryImageAttributes(ScrnInfoPtr pScrn, int image,
 	if (!fmt)
 		return 0;
 
-	ret = armada_drm_get_fmt_info(fmt, pitch, offset, *width, *height);
+	ret = armada_drm_get_fmt_info(fmt, pitch, offset, NULL, *width,
+				      *height);
 	if (ret) {
 		for (i = 0; i < fmt->xv_image.num_planes; i++) {
 			if (pitches)
@@ -697,7 +1088,7 @@ armada_drm_Xv_QueryImageAttributes_noxvbo(ScrnInfoPtr pScrn, int image,
 	unsigned short *width, unsigned short *height, int *pitches,
 	int *offsets)
 {
-	if (image == FOURCC_XVBO)
+	if (image == FOURCC_XVBO || image == FOURCC_XVPX)
 		return 0;
 
 	return armada_drm_Xv_QueryImageAttributes(pScrn, image, width, height,
@@ -710,9 +1101,18 @@ armada_drm_plane_fbid(ScrnInfoPtr pScrn, struct drm_xv *drmxv, int image,
 	unsigned char *buf, short width, short height, uint32_t *id)
 {
 	const struct xv_image_format *fmt;
-	Bool is_xvbo = image == FOURCC_XVBO;
+	Bool is_xvbo = image == FOURCC_XVBO || image == FOURCC_XVPX;
+	int (*get_fb)(ScrnInfoPtr, struct drm_xv *, unsigned char *,
+		uint32_t *);
 	int ret;
 
+	if (image == FOURCC_XVPX)
+		get_fb = armada_drm_get_xvpx;
+	else if (is_xvbo)
+		get_fb = armada_drm_get_xvbo;
+	else
+		get_fb = armada_drm_get_std;
+
 	if (is_xvbo)
 		/*
 		 * XVBO support allows applications to prepare the DRM
@@ -732,7 +1132,7 @@ armada_drm_plane_fbid(ScrnInfoPtr pScrn, struct drm_xv *drmxv, int image,
 
 	if (drmxv->width != width || drmxv->height != height ||
 	    drmxv->fourcc != image || !drmxv->plane_format ||
-	    drmxv->is_xvbo != is_xvbo) {
+	    drmxv->get_fb != get_fb) {
 		uint32_t size;
 
 		/* format or size changed */
@@ -741,21 +1141,19 @@ armada_drm_plane_fbid(ScrnInfoPtr pScrn, struct drm_xv *drmxv, int image,
 			return BadMatch;
 
 		/* Check whether this is XVBO mapping */
-		if (is_xvbo) {
-			drmxv->is_xvbo = TRUE;
-			drmxv->get_fb = armada_drm_get_xvbo;
-		} else {
-			drmxv->is_xvbo = FALSE;
-			drmxv->get_fb = armada_drm_get_std;
-		}
+		drmxv->is_xvbo = is_xvbo;
+		drmxv->get_fb = get_fb;
 
 		armada_drm_bufs_free(drmxv);
 
 		size = armada_drm_get_fmt_info(fmt, drmxv->pitches,
-					       drmxv->offsets, width, height);
+					       drmxv->offsets,
+					       drmxv->plane_sizes,
+					       width, height);
 
 		drmxv->plane_format = fmt;
 		drmxv->image_size = size;
+		drmxv->num_planes = fmt->xv_image.num_planes;
 		drmxv->width = width;
 		drmxv->height = height;
 		drmxv->fourcc = image;
@@ -825,12 +1223,17 @@ static void armada_drm_plane_disable(ScrnInfoPtr pScrn, struct drm_xv *drmxv,
 {
 	int ret;
 
+	armada_drm_wait_flip(drmxv);
+
 	ret = drmModeSetPlane(drmxv->fd, mode_plane->plane_id,
 			      0, 0, 0,  0, 0, 0, 0,  0, 0, 0, 0);
 	if (ret)
 		xf86DrvMsg(pScrn->scrnIndex, X_WARNING,
 			   "[drm] unable to disable plane %u: %s\n",
 			   mode_plane->plane_id, strerror(errno));
+
+	drmxv->scanout_fb_id = 0;
+	armada_drm_retire_fb(drmxv);
 }
 
 static void
@@ -887,6 +1290,8 @@ static Bool armada_drm_check_plane(ScrnInfoPtr pScrn, struct drm_xv *drmxv,
 		for (i = 0; i < drmxv->num_planes; i++)
 			if (drmxv->mode_planes[i]->possible_crtcs & crtc_mask) {
 				drmxv->overlay_plane = drmxv->mode_planes[i];
+				/* Atomic updates must set its properties */
+				drmxv->props_dirty = TRUE;
 				break;
 			}
 
@@ -917,6 +1322,7 @@ armada_drm_plane_Put(ScrnInfoPtr pScrn, struct drm_xv *drmxv, uint32_t fb_id,
 	xf86CrtcPtr crtc = NULL;
 	uint32_t crtc_x, crtc_y;
 	INT32 x1, x2, y1, y2;
+	int ret = Success;
 
 	x1 = src_x;
 	x2 = src_x + src_w;
@@ -935,10 +1341,21 @@ armada_drm_plane_Put(ScrnInfoPtr pScrn, struct drm_xv *drmxv, uint32_t fb_id,
 	crtc_x = dst->x1 - crtc->x;
 	crtc_y = dst->y1 - crtc->y;
 
-	drmModeSetPlane(drmxv->fd, drmxv->overlay_plane->plane_id,
-			common_crtc(crtc)->drm_id, fb_id, 0,
-			crtc_x, crtc_y, dst->x2 - dst->x1, dst->y2 - dst->y1,
-			x1, y1, x2 - x1, y2 - y1);
+#ifdef HAVE_DRM_ATOMIC
+	if (drmxv->has_atomic) {
+		ret = armada_drm_atomic_put(pScrn, drmxv, crtc, fb_id,
+					    crtc_x, crtc_y, dst,
+					    x1, y1, x2, y2);
+	} else
+#endif
+	{
+		drmModeSetPlane(drmxv->fd, drmxv->overlay_plane->plane_id,
+				common_crtc(crtc)->drm_id, fb_id, 0,
+				crtc_x, crtc_y,
+				dst->x2 - dst->x1, dst->y2 - dst->y1,
+				x1, y1, x2 - x1, y2 - y1);
+		drmxv->scanout_fb_id = fb_id;
+	}
 
 	if (drmxv->has_primary) {
 		BoxRec crtcbox;
@@ -962,7 +1379,7 @@ armada_drm_plane_Put(ScrnInfoPtr pScrn, struct drm_xv *drmxv, uint32_t fb_id,
 		drmxv->primary_obscured = obscured;
 	}
 
-	return Success;
+	return ret;
 }
 
 static int armada_drm_plane_PutImage(ScrnInfoPtr pScrn,
@@ -989,10 +1406,10 @@ static int armada_drm_plane_PutImage(ScrnInfoPtr pScrn,
 
 	armada_drm_xv_draw_colorkey(pScrn, pDraw, drmxv, clipBoxes, FALSE);
 
-	/* If there was a previous fb, release it. */
+	/* If there was a previous fb, release it once it is off screen. */
 	if (drmxv->is_xvbo &&
 	    drmxv->plane_fb_id && drmxv->plane_fb_id != fb_id) {
-		drmModeRmFB(drmxv->fd, drmxv->plane_fb_id);
+		armada_drm_release_fb(drmxv, drmxv->plane_fb_id);
 		drmxv->plane_fb_id = 0;
 	}
 
@@ -1038,7 +1455,7 @@ armada_drm_XvInitPlane(ScrnInfoPtr pScrn, DevUnion *priv, struct drm_xv *drmxv,
 	if (!p)
 		return NULL;
 
-	images = calloc(mode_plane->count_formats + 1, sizeof(*images));
+	images = calloc(mode_plane->count_formats + 2, sizeof(*images));
 	if (!images) {
 		free(p);
 		return NULL;
@@ -1058,6 +1475,8 @@ armada_drm_XvInitPlane(ScrnInfoPtr pScrn, DevUnion *priv, struct drm_xv *drmxv,
 
 	if (drmxv->has_xvbo)
 		images[num_images++] = (XF86ImageRec)XVIMAGE_XVBO;
+	if (drmxv->has_xvpx)
+		images[num_images++] = (XF86ImageRec)XVIMAGE_XVPX;
 
 	attrs = calloc(ARRAY_SIZE(armada_drm_xv_attributes), sizeof(*attrs));
 	if (!attrs) {
@@ -1190,7 +1609,17 @@ static void armada_drm_property_setup(struct drm_xv *drmxv,
 		if (strcmp(prop->name, armada_drm_property_names[i]) == 0) {
 			drmxv->props[i].prop_id = prop->prop_id;
 			drmxv->props[i].value = value;
-			break;
+			return;
+		}
+	}
+
+	for (i = 0; i < NR_ATOMIC_PROPS; i++) {
+		if (drmxv->atomic_props[i])
+			continue;
+
+		if (strcmp(prop->name, armada_drm_atomic_property_names[i]) == 0) {
+			drmxv->atomic_props[i] = prop->prop_id;
+			return;
 		}
 	}
 }
@@ -1243,7 +1672,7 @@ Bool armada_drm_XvInit(ScrnInfoPtr pScrn)
 	XF86VideoAdaptorPtr xv[2], ovl_adap = NULL, gpu_adap = NULL;
 	struct drm_xv *drmxv;
 	DevUnion priv[1];
-	unsigned num, cap = 0;
+	unsigned num, cap = 0, i;
 	Bool ret, prefer_overlay;
 
 	if (!armada_drm_init_atoms(pScrn))
@@ -1266,13 +1695,38 @@ Bool armada_drm_XvInit(ScrnInfoPtr pScrn)
 		drmxv->has_xvbo = TRUE;
 		drmxv->import_name = armada_drm_import_accel_name;
 	}
+	if (arm->accel_ops && arm->accel_ops->export_dmabuf)
+		drmxv->has_xvpx = TRUE;
 	drmxv->fd = drm->fd;
+	drmxv->drm = drm;
 	drmxv->bufmgr = arm->bufmgr;
 	drmxv->autopaint_colorkey = TRUE;
+	drmxv->flip.base.drm = drm;
+	drmxv->flip.base.handler = armada_drm_flip_handler;
+	drmxv->flip.drmxv = drmxv;
+
+#ifdef HAVE_DRM_ATOMIC
+	/*
+	 * The standard plane properties are only visible to clients
+	 * which enable atomic support, so this must be done first.
+	 */
+	if (xf86ReturnOptValBool(arm->Options, OPTION_XV_ATOMIC, TRUE))
+		drmxv->has_atomic = drmSetClientCap(drm->fd,
+						    DRM_CLIENT_CAP_ATOMIC,
+						    1) == 0;
+#endif
 
 	if (!armada_drm_gather_planes(pScrn, drmxv))
 		goto err_free;
 
+	for (i = 0; i < NR_ATOMIC_PROPS; i++)
+		if (!drmxv->atomic_props[i])
+			drmxv->has_atomic = FALSE;
+
+	if (drmxv->has_atomic)
+		xf86DrvMsg(pScrn->scrnIndex, X_INFO,
+			   "[drm] Xv: using atomic overlay updates\n");
+
 	if (!xf86ReturnOptValBool(arm->Options, OPTION_XV_DISPRIMARY, TRUE))
 		drmxv->has_primary = FALSE;
 